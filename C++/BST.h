@@ -1,14 +1,39 @@
 #ifndef DATE_H
 #define DATE_H
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 template <class key, class value>
-int Functor(std::pair<const key,value>& lhs, std::pair<const key,value>& rhs)
+int Functor(const std::pair<const key,value>& lhs, const std::pair<const key,value>& rhs)
 {
         if(lhs.first > rhs.first)
                 return 0;
@@ -18,42 +43,679 @@ int Functor(std::pair<const key,value>& lhs, std::pair<const key,value>& rhs)
                 return 2;
 }
 
+//true if std::hash<key> is enabled; BST only hashes such keys, everything else needs just the comparisons
+template <class key, class = void>
+struct is_hashable : std::false_type {};
+template <class key>
+struct is_hashable<key, std::void_t<decltype(std::hash<key>{}(std::declval<const key&>()))> > : std::true_type {};
+
+//aggregation policies: a monoid over value, folded over every subtree by BST
+template <class value>
+struct NoAggregation {
+        struct type {};
+        static type identity() {
+                return type{};
+        }
+        static type lift(const value&) {
+                return type{};
+        }
+        static type combine(const type&, const type&) {
+                return type{};
+        }
+};
+
+template <class value>
+struct SumAggregation {
+        using type = value;
+        static type identity() {
+                return value{};
+        }
+        static type lift(const value& v) {
+                return v;
+        }
+        static type combine(const type& lhs, const type& rhs) {
+                return lhs + rhs;
+        }
+};
+
+template <class value>
+struct MinAggregation {
+        using type = value;
+        static type identity() {
+                return std::numeric_limits<value>::max();
+        }
+        static type lift(const value& v) {
+                return v;
+        }
+        static type combine(const type& lhs, const type& rhs) {
+                return std::min(lhs, rhs);
+        }
+};
+
+template <class value>
+struct MaxAggregation {
+        using type = value;
+        static type identity() {
+                return std::numeric_limits<value>::lowest();
+        }
+        static type lift(const value& v) {
+                return v;
+        }
+        static type combine(const type& lhs, const type& rhs) {
+                return std::max(lhs, rhs);
+        }
+};
+
+//stores the per-node aggregate, taking no space for empty aggregate types
+template <class T, bool = std::is_empty<T>::value>
+struct AggregateSlot {
+        T aggregate_value;
+        T& aggregate() {
+                return aggregate_value;
+        }
+        const T& aggregate() const {
+                return aggregate_value;
+        }
+};
+
+template <class T>
+struct AggregateSlot<T, true> : private T {
+        T& aggregate() {
+                return *this;
+        }
+        const T& aggregate() const {
+                return *this;
+        }
+};
+
+//binary snapshot: a 64 byte header followed by the pairs in ascending key order, native byte order
+struct BSTSnapshotHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t key_size;
+        std::uint32_t value_size;
+        std::uint32_t record_size;
+        std::uint64_t count;
+        std::uint64_t checksum;
+        char reserved[24];
+};
+static_assert(sizeof(BSTSnapshotHeader) == 64, "snapshot header layout changed");
+
+static const char BSTSnapshotMagic[8] = {'B', 'S', 'T', 'S', 'N', 'A', 'P', '\0'};
+static const std::uint32_t BSTSnapshotVersion = 1;
+
+//FNV-1a over the record bytes
+inline std::uint64_t snapshot_checksum(const char* data, std::size_t length, std::uint64_t hash = 14695981039346656037ULL) {
+        for (std::size_t i = 0; i < length; ++i) {
+                hash ^= static_cast<unsigned char>(data[i]);
+                hash *= 1099511628211ULL;
+        }
+        return hash;
+}
+
+//read-only private mapping of a whole file, unmapped on destruction
+class MappedFile
+{
+private:
+void* mapping;
+std::size_t mapping_size;
+
+public:
+explicit MappedFile(const std::string& path, int advice = MADV_NORMAL) : mapping{nullptr}, mapping_size{0} {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+                throw std::runtime_error("could not open " + path);
+        struct stat file_status;
+        if (fstat(fd, &file_status) != 0) {
+                close(fd);
+                throw std::runtime_error("could not stat " + path);
+        }
+        mapping_size = file_status.st_size;
+        if (mapping_size != 0)
+                mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+                mapping = nullptr;
+                throw std::runtime_error("could not map " + path);
+        }
+        if (mapping != nullptr)
+                madvise(mapping, mapping_size, advice);
+}
+MappedFile(const MappedFile&) = delete;
+MappedFile& operator=(const MappedFile&) = delete;
+MappedFile(MappedFile&& rhs) : mapping{rhs.mapping}, mapping_size{rhs.mapping_size} {
+        rhs.mapping = nullptr;
+        rhs.mapping_size = 0;
+}
+~MappedFile() {
+        if (mapping != nullptr)
+                munmap(mapping, mapping_size);
+}
+
+const char* data() const {
+        return static_cast<const char*>(mapping);
+}
+std::size_t size() const {
+        return mapping_size;
+}
+};
+
+//a std::pmr::memory_resource handing out memory from 2 MB pages, so that a PmrBST of millions of nodes needs a few hundred
+//TLB entries instead of one per 4 KB page. It maps reserved huge pages (MAP_HUGETLB) while the system has them and falls
+//back to 2 MB aligned mappings advised for transparent huge pages; huge_pages = false maps plain 4 KB pages instead.
+//Requests up to 1 KB, like nodes, are carved from shared pages and reused through free lists by size, larger ones, like
+//the block of compact(), get a mapping of their own. Like the std::pmr pool resources it is not synchronised
+class HugePageResource : public std::pmr::memory_resource
+{
+private:
+static constexpr std::size_t page_size = std::size_t(1) << 21;
+static constexpr std::size_t granularity = 16;
+static constexpr std::size_t small_limit = 1024;
+struct mapping {
+        void* address;
+        std::size_t size;
+        bool reserved;
+};
+bool huge_pages;
+bool try_reserved;
+std::vector<mapping> mappings;
+char* current = nullptr;
+char* current_end = nullptr;
+void* free_lists[small_limit / granularity] = {};
+
+static std::size_t round_to_pages(std::size_t bytes) {
+        return (bytes + page_size - 1) & ~(page_size - 1);
+}
+void* map_pages(std::size_t size) {
+        mappings.reserve(mappings.size() + 1);
+        if (try_reserved) {
+                void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (address != MAP_FAILED) {
+                        mappings.push_back(mapping{address, size, true});
+                        return address;
+                }
+                try_reserved = false;
+        }
+        //transparent huge pages need 2 MB alignment, so an aligned range is cut out of a mapping one page larger
+        void* raw = mmap(nullptr, size + page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+                throw std::bad_alloc();
+        std::uintptr_t start = reinterpret_cast<std::uintptr_t>(raw);
+        std::uintptr_t aligned = (start + page_size - 1) & ~(page_size - 1);
+        if (aligned != start)
+                munmap(raw, aligned - start);
+        munmap(reinterpret_cast<void*>(aligned + size), start + page_size - aligned);
+        void* address = reinterpret_cast<void*>(aligned);
+        madvise(address, size, huge_pages ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+        mappings.push_back(mapping{address, size, false});
+        return address;
+}
+
+protected:
+void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (bytes <= small_limit && alignment <= granularity) {
+                std::size_t size = std::max((bytes + granularity - 1) & ~(granularity - 1), granularity);
+                void*& head = free_lists[size / granularity - 1];
+                if (head != nullptr) {
+                        void* p = head;
+                        head = *static_cast<void**>(p);
+                        return p;
+                }
+                if (std::size_t(current_end - current) < size) {
+                        current = static_cast<char*>(map_pages(page_size));
+                        current_end = current + page_size;
+                }
+                void* p = current;
+                current += size;
+                return p;
+        }
+        if (alignment > page_size)
+                throw std::bad_alloc();
+        return map_pages(round_to_pages(bytes));
+}
+void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        if (bytes <= small_limit && alignment <= granularity) {
+                std::size_t size = std::max((bytes + granularity - 1) & ~(granularity - 1), granularity);
+                void*& head = free_lists[size / granularity - 1];
+                *static_cast<void**>(p) = head;
+                head = p;
+                return;
+        }
+        auto found = std::find_if(mappings.begin(), mappings.end(), [p](const mapping& m) {
+                return m.address == p;
+        });
+        if (found != mappings.end()) {
+                munmap(found->address, found->size);
+                mappings.erase(found);
+        }
+}
+bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+}
+
+public:
+explicit HugePageResource(bool huge_pages = true) : huge_pages{huge_pages}, try_reserved{huge_pages} {}
+HugePageResource(const HugePageResource&) = delete;
+HugePageResource& operator=(const HugePageResource&) = delete;
+~HugePageResource() {
+        for (const auto& m : mappings)
+                munmap(m.address, m.size);
+}
+
+std::size_t mapped_bytes() const {
+        std::size_t bytes = 0;
+        for (const auto& m : mappings)
+                bytes += m.size;
+        return bytes;
+}
+//the part of mapped_bytes() on reserved huge pages; the rest is left to transparent huge pages or 4 KB pages
+std::size_t reserved_bytes() const {
+        std::size_t bytes = 0;
+        for (const auto& m : mappings)
+                if (m.reserved)
+                        bytes += m.size;
+        return bytes;
+}
+};
+
+//read-only view of a snapshot file, answering find and iteration straight from the mapped pages
+template <class key, class value>
+class BSTSnapshot
+{
+private:
+MappedFile file;
+const std::pair<const key, value>* records;
+std::size_t count;
+
+public:
+using ConstIterator = const std::pair<const key, value>*;
+
+explicit BSTSnapshot(const std::string& path, bool verify_checksum = true);
+
+ConstIterator begin() const {
+        return records;
+}
+ConstIterator end() const {
+        return records + count;
+}
+ConstIterator cbegin() const {
+        return begin();
+}
+ConstIterator cend() const {
+        return end();
+}
+std::size_t size() const {
+        return count;
+}
+template <class K = key>
+ConstIterator find(const K& k) const;
+template <class K = key>
+const value& operator[](const K& k) const;
+};
+
+template <class key, class value>
+BSTSnapshot<key, value>::BSTSnapshot(const std::string& path, bool verify_checksum) : file{path, MADV_WILLNEED}, records{nullptr}, count{0} {
+        static_assert(std::is_trivially_copyable<key>::value && std::is_trivially_copyable<value>::value, "snapshots need trivially copyable key and value types");
+        static_assert(alignof(std::pair<const key, value>) <= sizeof(BSTSnapshotHeader), "record alignment exceeds the header size");
+
+        if (file.size() < sizeof(BSTSnapshotHeader))
+                throw std::runtime_error("snapshot " + path + " is truncated");
+        BSTSnapshotHeader header;
+        std::memcpy(&header, file.data(), sizeof(header));
+        const char* data = file.data() + sizeof(BSTSnapshotHeader);
+        if (std::memcmp(header.magic, BSTSnapshotMagic, sizeof(header.magic)) != 0)
+                throw std::runtime_error("snapshot " + path + " is not a BST snapshot");
+        if (header.version != BSTSnapshotVersion)
+                throw std::runtime_error("snapshot " + path + " has unsupported version " + std::to_string(header.version));
+        if (header.key_size != sizeof(key) || header.value_size != sizeof(value) || header.record_size != sizeof(std::pair<const key, value>))
+                throw std::runtime_error("snapshot " + path + " was written for different key or value types");
+        //count is bounded by the file before it is multiplied, so a forged count cannot wrap the length around
+        if (header.count > (file.size() - sizeof(BSTSnapshotHeader)) / header.record_size ||
+            file.size() != sizeof(BSTSnapshotHeader) + header.count * header.record_size)
+                throw std::runtime_error("snapshot " + path + " is truncated");
+        if (verify_checksum && snapshot_checksum(data, header.count * header.record_size) != header.checksum)
+                throw std::runtime_error("snapshot " + path + " has a checksum mismatch");
+        records = reinterpret_cast<const std::pair<const key, value>*>(data);
+        count = header.count;
+}
+
+template <class key, class value>
+template <class K>
+typename BSTSnapshot<key, value>::ConstIterator BSTSnapshot<key, value>::find(const K& k) const {
+        ConstIterator it = std::lower_bound(begin(), end(), k, [](const std::pair<const key, value>& record, const K& k) {
+                return record.first < k;
+        });
+        if (it != end() && it->first == k)
+                return it;
+        return end();
+}
+
+template <class key, class value>
+template <class K>
+const value& BSTSnapshot<key, value>::operator[](const K& k) const {
+        ConstIterator it = find(k);
+        if (it != end())
+                return it->second;
+        throw std::runtime_error("tried accessing not existing key in BST snapshot");
+}
+
+//hit and miss counts of the optional lookup cache in front of BST::find
+struct LookupCacheStats {
+        std::size_t hits;
+        std::size_t misses;
+        double hit_rate() const {
+                return hits + misses ? double(hits) / (hits + misses) : 0;
+        }
+};
+
+//memory held by a tree: node_bytes covers the nodes themselves but not heap memory owned by keys or values,
+//auxiliary_bytes the lookup cache and the Bloom filter
+struct BSTMemoryUsage {
+        std::size_t nodes;
+        std::size_t node_bytes;
+        std::size_t auxiliary_bytes;
+        std::size_t bytes() const {
+                return node_bytes + auxiliary_bytes;
+        }
+};
+
+//self-adjusting lookups: full splaying moves the found node to the root, semi-splaying roughly halves its depth
+enum class SplayMode { off, full, semi };
+//node orders of BST::compact: van Emde Boas keeps every subtree of about half the remaining height in one stretch,
+//breadth-first stores the tree level by level
+enum class NodeLayout { van_emde_boas, breadth_first };
+
 
-template <class key, class value, class comparator = decltype(& Functor<const key,value>) >
+template <class key, class value, class comparator = decltype(& Functor<const key,value>), class aggregator = NoAggregation<value>, class Allocator = std::allocator<std::pair<const key, value> > >
 class BST
 {
 private:
-struct node
+using aggregate_type = typename aggregator::type;
+//values of an aggregating tree change only through insert, which refreshes the aggregates on the path; writes through
+//operator[], an Iterator or for_each would leave them stale, so those give read-only access there
+static constexpr bool mutable_values = std::is_same<aggregator, NoAggregation<value> >::value;
+//the lookup cache and the Bloom filter are keyed by std::hash; for other keys they cannot be switched on and compile out
+static constexpr bool hashable_keys = is_hashable<key>::value;
+static std::uint64_t hash_key(const key& k) {
+        if constexpr (hashable_keys)
+                return static_cast<std::uint64_t>(std::hash<key>{}(k)) * 0x9E3779B97F4A7C15ULL;
+        else
+                return 0;
+}
+
+struct node;
+using node_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<node>;
+using node_traits = std::allocator_traits<node_allocator>;
+
+//frees a node through a copy of the tree's allocator, so an empty allocator adds nothing to the child pointers;
+//all nodes of a tree hold equal allocators, hence assigning a deleter keeps its own one
+struct node_deleter : node_allocator {
+        node_deleter(const node_allocator& a) : node_allocator{a} {}
+        node_deleter(const node_deleter&) = default;
+        node_deleter& operator=(const node_deleter&) {
+                return *this;
+        }
+        void operator()(node* n) {
+                node_allocator& a = *this;
+                bool in_block = n->in_block;
+                node_traits::destroy(a, n);
+                //nodes placed by compact() go back with their whole block
+                if (!in_block)
+                        node_traits::deallocate(a, n, 1);
+        }
+};
+using node_ptr = std::unique_ptr<node, node_deleter>;
+
+struct node : AggregateSlot<aggregate_type>
 {
         std::pair<const key, value> data_pair;
-        std::unique_ptr<node> left;
-        std::unique_ptr<node> right;
+        node_ptr left;
+        node_ptr right;
         node* local_root;
-        node(const std::pair<const key, value>&p, node* l, node* r, node* lr) :
-                data_pair{p},left{l},right{r}, local_root{lr} {
+        std::size_t subtree_size;
+        std::uint32_t hits;
+        //set for nodes living in a node_block, fits the padding after hits
+        std::uint8_t in_block;
+        node(const std::pair<const key, value>&p, node* lr, const node_deleter& d) :
+                data_pair{p},left{nullptr, d},right{nullptr, d}, local_root{lr}, subtree_size{1}, hits{0}, in_block{0} {
+                this->aggregate() = aggregator::lift(data_pair.second);
+        }
+        template <class V>
+        node(const key& k, V&& v, node* lr, const node_deleter& d) :
+                data_pair{k, std::forward<V>(v)},left{nullptr, d},right{nullptr, d}, local_root{lr}, subtree_size{1}, hits{0}, in_block{0} {
+                this->aggregate() = aggregator::lift(data_pair.second);
         }
 
         ~node() = default;
 
 };
 
-std::unique_ptr<node> root_node;
+//one allocation holding the nodes compact() laid out; they are destroyed one by one, but the memory goes back in one
+//piece once no tree or node handle refers to the block any more
+struct node_block {
+        node_allocator allocator;
+        node* nodes;
+        std::size_t capacity;
+        node_block(const node_allocator& a, std::size_t n) : allocator{a}, nodes{node_traits::allocate(allocator, n)}, capacity{n} {}
+        node_block(const node_block&) = delete;
+        node_block& operator=(const node_block&) = delete;
+        ~node_block() {
+                node_traits::deallocate(allocator, nodes, capacity);
+        }
+        bool holds(const node* n) const {
+                return !std::less<const node*>()(n, nodes) && std::less<const node*>()(n, nodes + capacity);
+        }
+};
+
+node_allocator allocator;
+//declared before root_node, so that the nodes are destroyed before their blocks
+std::vector<std::shared_ptr<node_block> > blocks;
+node_ptr root_node;
 comparator MyComparator;
+SplayMode splay_mode = SplayMode::off;
+unsigned splay_period = 1;
+unsigned splay_countdown = 1;
+unsigned sampling_period = 0;
+mutable unsigned sampling_countdown = 0;
+
+//direct-mapped key to node cache; entries of an older generation are stale, so dropping nodes en masse is O(1)
+struct lookup_cache {
+        struct entry {
+                node* cached;
+                std::uint64_t generation;
+        };
+        std::vector<entry> entries;
+        unsigned shift;
+        std::uint64_t generation = 1;
+        std::size_t hits = 0;
+        std::size_t misses = 0;
+
+        explicit lookup_cache(std::size_t slots) : entries(), shift{64} {
+                std::size_t capacity = 1;
+                while (capacity < slots) {
+                        capacity *= 2;
+                        --shift;
+                }
+                entries.assign(capacity, entry{nullptr, 0});
+        }
+        entry& slot(const key& k) {
+                std::uint64_t h = hash_key(k);
+                return entries[shift == 64 ? 0 : h >> shift];
+        }
+};
+std::unique_ptr<lookup_cache> cache;
+
+//blocked Bloom filter: a key sets and tests all of its bits inside one 64 byte block, so a probe touches one cache line
+struct bloom_filter {
+        struct alignas(64) block {
+                std::uint64_t words[8];
+        };
+        std::vector<block> blocks;
+        double false_positive_rate;
+        unsigned probes;
+        std::size_t capacity;
+        std::size_t added;
+
+        bloom_filter(double rate, std::size_t keys) : blocks(), false_positive_rate{rate} {
+                reset(keys);
+        }
+        //sizes the filter for keys entries with the textbook optimum, m/n = -ln(p)/ln(2)^2 bits and k = m/n ln(2) probes
+        void reset(std::size_t keys) {
+                capacity = std::max<std::size_t>(keys, 1024);
+                double bits_per_key = -std::log(false_positive_rate) / (std::log(2.0) * std::log(2.0));
+                probes = static_cast<unsigned>(std::min(16.0, std::max(1.0, std::round(bits_per_key * std::log(2.0)))));
+                blocks.assign(static_cast<std::size_t>(std::ceil(capacity * bits_per_key / 512)), block{});
+                added = 0;
+        }
+        static std::uint64_t hash_of(const key& k) {
+                return hash_key(k);
+        }
+        //the high half of the hash picks the block, a remixed hash drives double hashing over its 512 bits
+        block& block_of(std::uint64_t h) {
+                return blocks[((h >> 32) * blocks.size()) >> 32];
+        }
+        const block& block_of(std::uint64_t h) const {
+                return blocks[((h >> 32) * blocks.size()) >> 32];
+        }
+        static std::uint64_t positions_of(std::uint64_t h) {
+                h ^= h >> 31;
+                return h * 0xBF58476D1CE4E5B9ULL;
+        }
+        void add(const key& k) {
+                std::uint64_t h = hash_of(k);
+                block& target = block_of(h);
+                std::uint64_t positions = positions_of(h);
+                unsigned bit = positions >> 55, step = (positions >> 23 & 511) | 1;
+                for (unsigned i = 0; i < probes; ++i, bit = (bit + step) & 511)
+                        target.words[bit >> 6] |= std::uint64_t(1) << (bit & 63);
+                ++added;
+        }
+        bool may_contain(const key& k) const {
+                std::uint64_t h = hash_of(k);
+                const block& target = block_of(h);
+                std::uint64_t positions = positions_of(h);
+                unsigned bit = positions >> 55, step = (positions >> 23 & 511) | 1;
+                for (unsigned i = 0; i < probes; ++i, bit = (bit + step) & 511)
+                        if ((target.words[bit >> 6] & std::uint64_t(1) << (bit & 63)) == 0)
+                                return false;
+                return true;
+        }
+};
+std::unique_ptr<bloom_filter> filter;
+void rebuild_filter();
+//sets the bits of a key just linked into the tree; a full filter is regrown from the tree, which already holds the key
+void filter_new_key(const key& k) {
+        if (filter->added >= filter->capacity) {
+                filter->capacity = 2 * std::max(filter->capacity, size());
+                rebuild_filter();
+        }
+        else
+                filter->add(k);
+}
+
+void record_access(node* n) const;
+void invalidate_cache() {
+        if (cache)
+                ++cache->generation;
+}
+
+node_ptr make_node(const std::pair<const key, value>& p, node* local_root);
+node_ptr make_node(std::pair<const key, value>&& p, node* local_root);
+//v is only moved from once the node's memory is allocated
+template <class V>
+node_ptr make_node(const key& k, V&& v, node* local_root);
+node_ptr no_node() {
+        return node_ptr(nullptr, node_deleter{allocator});
+}
+node* insert_node(const key& k, const value& v, node* start = nullptr);
+//takes the value out of p, into the new node or over the old value
+node* insert_node(std::pair<const key, value>&& p, node* start = nullptr);
+node* insert_hinted(node* hint, std::pair<const key, value>&& p);
+//climbs from finger to the lowest node whose subtree holds k's position; only the ancestors where the path turns
+//towards k cost a comparison, so a finger next to k costs O(1) comparisons
+template <class K>
+node* finger_subtree(node* finger, const K& k) const;
+template <class RandomIt, class OutputIt>
+void find_sorted_recursive(node* current, RandomIt first, RandomIt last, OutputIt& out) const;
+node* add_node_recursive(std::pair<const key, value>&& p, node* current);
+//inserts a batch sorted by and unique in key_of(item) in one descent: the batch is split at every node on the way, so a
+//path shared by several keys is walked and re-augmented once, and the keys meeting an empty subtree fill it balanced.
+//visit(item, node) sees each item's node, found or created with value{}, before that node's augmentation is refreshed
+template <class RandomIt, class KeyOf, class Visit>
+void insert_batch(RandomIt first, RandomIt last, KeyOf key_of, Visit visit);
+template <class RandomIt, class KeyOf, class Visit>
+void insert_batch_recursive(node_ptr& slot, node* local_root, RandomIt first, RandomIt last, KeyOf& key_of, Visit& visit);
+template <class RandomIt>
+node_ptr balance_recursive(RandomIt sorted, std::size_t start, std::size_t end, node* local_root);
+node_ptr deepcopy_recursive(const node_ptr& source, node* local_root);
+template <class F>
+static void for_each_node(node* current, F f);
+
+//a contiguous in-order piece of the tree: either a whole subtree or a single node
+struct piece {
+        node* root;
+        bool whole_subtree;
+};
+void collect_pieces(node* current, std::size_t grain, std::vector<piece>& pieces) const;
+template <class Task>
+static void run_tasks(std::size_t tasks, unsigned threads, Task task);
+
+static std::size_t subtree_size_of(const node* n) {
+        return n ? n->subtree_size : 0;
+}
+static aggregate_type aggregate_of(const node* n) {
+        return n ? n->aggregate() : aggregator::identity();
+}
+void update_node(node* n);
+void update_path(node* n);
+node_ptr& owner_of(node* n);
+void rotate_up(node* n);
+void splay(node* n);
+node_ptr weighted_recursive(const std::vector<node*>& nodes, const std::vector<double>& prefix, std::size_t start, std::size_t end, node* local_root);
+node_ptr relink_recursive(const std::vector<node*>& nodes, std::size_t start, std::size_t end, node* local_root);
+void rebuild_subtree(node* n);
+node_ptr unlink_node(node* n);
+//moves the block references of from into this tree, which now holds nodes of those blocks
+void share_blocks(std::vector<std::shared_ptr<node_block> >& from) {
+        for (auto& block : from)
+                if (std::find(blocks.begin(), blocks.end(), block) == blocks.end())
+                        blocks.push_back(std::move(block));
+        from.clear();
+}
+std::size_t tree_height() const;
+static void van_emde_boas_order(node* root, std::size_t height, std::vector<node*>& order, std::vector<node*>& bottoms);
+std::vector<node*> release_nodes();
+//clear() and move assignment without their messages, for the internal moves of BST and the containers built on it
+void reset_nodes();
+void take_over(BST&& rhs);
+void copy_settings(const BST& rhs) {
+        set_splay_mode(rhs.splay_mode, rhs.splay_period);
+        set_access_sampling(rhs.sampling_period);
+        set_lookup_cache(rhs.cache ? rhs.cache->entries.size() : 0);
+        set_bloom_filter(rhs.bloom_filter_rate(), rhs.filter ? rhs.filter->capacity : 0);
+}
 
-void add_node_recursive(std::pair<const key, value> p, node* current);
-void balance_recursive(std::vector<std::pair<const key, value> >& vec, std::size_t start, std::size_t end);
-void deepcopy_recursive(const std::unique_ptr<node>& node);
+template <class, class, class>
+friend class HashIndexedBST;
+template <class, class>
+friend class ShardedBST;
+template <class, class>
+friend class CombiningBST;
 
 public:
 
 
-BST() {
+BST() : BST(Allocator{}) {};
+//every node of the tree is allocated from alloc, rebound to the node type
+explicit BST(const Allocator& alloc) : allocator{alloc}, root_node{nullptr, node_deleter{allocator}} {
         root_node=nullptr;
         MyComparator = Functor;
 };
 
 class Iterator;
 class ConstIterator;
+class NodeHandle;
+struct InsertReturn;
 
 Iterator begin();
 Iterator end() {
@@ -63,14 +725,163 @@ ConstIterator cbegin() const;
 ConstIterator cend() const {
         return ConstIterator{nullptr};
 };
+ConstIterator begin() const {
+        return cbegin();
+};
+ConstIterator end() const {
+        return cend();
+};
 
-void insert(const key k, value v);
+void insert(const key& k, const value& v);
+//inserts from the hint instead of the root, replacing the value of an existing key like insert(k, v); a hint at or next
+//to k's position costs O(1) comparisons. Hinted inserts keep the depth they reach logarithmic by rebuilding an unbalanced
+//subtree above the new node, like a scapegoat tree, so runs of increasing keys take amortised O(log n) instead of O(n)
+Iterator insert(ConstIterator hint, const key& k, const value& v);
+template <class... Args>
+Iterator emplace_hint(ConstIterator hint, Args&&... args) {
+        return insert_hinted(hint.current_node, std::pair<const key, value>(std::forward<Args>(args)...));
+}
 void clear();
 void balance();
-ConstIterator find(const key k) const;
-value& operator[](const key& k);
-const value& operator[](const key& k) const;
+void balance(NodeLayout layout) {
+        balance();
+        compact(layout);
+}
+//moves all nodes into one allocation, in the given order, so that a search touches fewer cache lines and pages; the shape
+//stays as it is. Values are moved if that cannot throw and copied otherwise. Iterators are invalidated, and the memory of
+//nodes erased or extracted afterwards goes back with the whole block on the next compact, balance or clear
+void compact(NodeLayout layout = NodeLayout::van_emde_boas);
+//every every_kth_find-th successful find counts a hit on the found node, 0 switches sampling off;
+//counting writes to the nodes, so sampled trees must not be searched from several threads
+void set_access_sampling(unsigned every_kth_find) {
+        sampling_period = every_kth_find;
+        sampling_countdown = every_kth_find;
+}
+void reset_access_counts();
+//caches up to slots (rounded to a power of two) key to node entries in front of find and operator[], 0 removes the cache;
+//like sampling, a cached tree must not be searched from several threads. Keys without std::hash never get a cache
+void set_lookup_cache(std::size_t slots) {
+        if (slots == 0 || !hashable_keys)
+                cache.reset();
+        else
+                cache.reset(new lookup_cache(slots));
+}
+LookupCacheStats lookup_cache_stats() const {
+        return cache ? LookupCacheStats{cache->hits, cache->misses} : LookupCacheStats{0, 0};
+}
+//lets find and contains reject most absent keys with a single cache line probe; the filter is sized for expected_keys
+//and doubled when more keys arrive, false_positive_rate 0 removes it. Erased keys keep their bits until the next
+//balance() or clear(), so they only raise the false positive rate. Probing never writes, concurrent readers are fine.
+//Keys without std::hash never get a filter
+void set_bloom_filter(double false_positive_rate, std::size_t expected_keys = 0);
+double bloom_filter_rate() const {
+        return filter ? filter->false_positive_rate : 0;
+}
+std::size_t bloom_filter_bytes() const {
+        return filter ? filter->blocks.size() * sizeof(typename bloom_filter::block) : 0;
+}
+//false only if k is certainly absent; without a filter, or for a K other than key, always true
+template <class K = key>
+bool may_contain(const K& k) const;
+void balance_weighted();
+double weighted_path_length() const;
+void save(const std::string& path) const;
+void load(const std::string& path);
+void load_text(const std::string& path);
+template <class RandomIt>
+void assign_sorted(RandomIt first, RandomIt last);
+//the non-const for_each and operator[] exist only without aggregation, so that a const for_each or operator[] is chosen
+//on an aggregating tree
+template <class F, bool M = mutable_values, typename std::enable_if<M, int>::type = 0>
+void for_each(F f);
+template <class F>
+void for_each(F f) const;
+template <class F>
+void parallel_for_each(F f, unsigned threads = 0);
+template <class T, class Reduce, class Transform>
+T parallel_transform_reduce(T init, Reduce op, Transform transform, unsigned threads = 0) const;
+template <class T, class Reduce>
+T parallel_reduce(T init, Reduce op, unsigned threads = 0) const;
+//lookups accept any type comparable with key, so no temporary key has to be built. The lookup cache and the Bloom
+//filter hash key itself, hence find and contains with another K always walk the tree: no cache hit, no filter rejection.
+//Converting K to key would not be safe in general, e.g. a long narrowed to an int key could match the wrong node
+template <class K = key>
+ConstIterator find(const K& k) const;
+template <class K = key>
+Iterator find(const K& k);
+//finger search: starts from finger instead of the root, O(log d) on a balanced tree for a finger d keys away from k;
+//it bypasses the lookup cache and splaying, and an end() finger searches from the root
+template <class K = key>
+ConstIterator find_from(ConstIterator finger, const K& k) const;
+template <class K = key>
+Iterator find_from(ConstIterator finger, const K& k) {
+        return static_cast<const BST&>(*this).find_from(finger, k).current_node;
+}
+//looks up the sorted keys [first, last) in one descent that splits them at every node and skips the subtrees none of
+//them falls into, visiting each node at most once: O(min(n, k log(n/k))) on a balanced tree. Writes one ConstIterator
+//per key to out, in the order of the keys, cend() for a missing one
+template <class RandomIt, class OutputIt>
+OutputIt find_sorted(RandomIt first, RandomIt last, OutputIt out) const {
+        find_sorted_recursive(root_node.get(), first, last, out);
+        return out;
+}
+template <class K = key>
+bool contains(const K& k) const {
+        return find(k) != cend();
+}
+template <class K = key>
+ConstIterator lower_bound(const K& k) const;
+template <class K = key>
+ConstIterator upper_bound(const K& k) const;
+template <class K = key>
+bool erase(const K& k);
+//node handles: extract unlinks a node and hands it over, insert links it into this or another tree of an equal allocator,
+//so neither key nor value is copied or reallocated; an empty handle comes back for a missing key
+NodeHandle extract(Iterator position);
+NodeHandle extract(ConstIterator position);
+template <class K = key>
+NodeHandle extract(const K& k);
+//unlike insert(k, v), a key that is already present keeps its value and the handle is returned in InsertReturn::node
+InsertReturn insert(NodeHandle&& handle);
+//the partitioning operations move nodes instead of copying them, unless the allocators of the trees differ;
+//split and join are O(height), merge is O(n + m). An attached Bloom filter is rebuilt, which costs O(n)
+
+//empties the tree into one holding the keys below k and one holding the keys at or above k
+template <class K = key>
+std::pair<BST, BST> split(const K& k);
+//concatenates two trees whose keys do not interleave, every key of left below every key of right
+static BST join(BST&& left, BST&& right);
+//moves all pairs of other into this tree as a balanced tree, the value of other winning for keys present in both
+void merge(BST& other);
+//in splay mode every every_kth_access-th successful non-const find or operator[] restructures the tree
+void set_splay_mode(SplayMode mode, unsigned every_kth_access = 1) {
+        splay_mode = mode;
+        splay_period = std::max(1u, every_kth_access);
+        splay_countdown = splay_period;
+}
+std::size_t size() const {
+        return subtree_size_of(root_node.get());
+}
+BSTMemoryUsage memory_usage() const {
+        return BSTMemoryUsage{size(), size() * sizeof(node),
+                              (cache ? cache->entries.capacity() * sizeof(typename lookup_cache::entry) : 0) + bloom_filter_bytes()};
+}
+Allocator get_allocator() const {
+        return Allocator(allocator);
+}
+template <class K = key>
+std::size_t rank(const K& k) const;
+ConstIterator select(std::size_t i) const;
+template <class K = key>
+std::size_t count_range(const K& a, const K& b) const;
+template <class K = key>
+aggregate_type reduce(const K& a, const K& b) const;
+template <class K = key, bool M = mutable_values, typename std::enable_if<M, int>::type = 0>
+value& operator[](const K& k);
+template <class K = key>
+const value& operator[](const K& k) const;
 BST(const BST &bst_rhs);
+BST(const BST &bst_rhs, const Allocator& alloc);
 BST& operator=(const BST &bst_rhs);
 BST(BST&& bst_rhs);
 BST& operator=(BST&& bst_rhs);
@@ -80,19 +891,28 @@ BST& operator=(BST&& bst_rhs);
 };
 
 
-template <class key, class value, class comparator>
-class BST<key, value, comparator>::Iterator {
-using node = BST<key, value, comparator>::node;
+template <class key, class value, class comparator, class aggregator, class Allocator>
+class BST<key, value, comparator, aggregator, Allocator>::Iterator {
+using node = BST<key, value, comparator, aggregator, Allocator>::node;
 
 node* current_node;
+friend class BST<key, value, comparator, aggregator, Allocator>;
 
 public:
+using iterator_category = std::forward_iterator_tag;
+using value_type = std::pair<const key, value>;
+using difference_type = std::ptrdiff_t;
+using pointer = typename std::conditional<mutable_values, value_type*, const value_type*>::type;
+using reference = typename std::conditional<mutable_values, value_type&, const value_type&>::type;
 
-Iterator(node* n) : current_node{n}  {}
+Iterator(node* n = nullptr) : current_node{n}  {}
 
-std::pair<const key, value>& operator*() const {
+reference operator*() const {
         return current_node->data_pair;
 }
+pointer operator->() const {
+        return &current_node->data_pair;
+}
 
 Iterator& operator++() {
         if (current_node->right != nullptr) {
@@ -119,39 +939,177 @@ Iterator operator++(int){
         return it;
 }
 
-bool operator==(const Iterator& other) {
+bool operator==(const Iterator& other) const {
         return current_node == other.current_node;
 }
-bool operator!=(const Iterator& other) {
+bool operator!=(const Iterator& other) const {
         return !(*this == other);
 }
 
 };
 
-template <class key, class value, class comparator>
-class BST<key, value, comparator>::ConstIterator : public BST<key, value, comparator>::Iterator {
+template <class key, class value, class comparator, class aggregator, class Allocator>
+class BST<key, value, comparator, aggregator, Allocator>::ConstIterator : public BST<key, value, comparator, aggregator, Allocator>::Iterator {
 public:
-using parent = const BST<key, value, comparator>::Iterator;
+using parent = const BST<key, value, comparator, aggregator, Allocator>::Iterator;
 using parent::Iterator;
-std::pair<const key, value> operator*() const {
+using pointer = const std::pair<const key, value>*;
+using reference = const std::pair<const key, value>&;
+
+ConstIterator(const parent& it) : parent{it} {}
+
+//returns a reference into the node, so reading a pair never copies key or value
+reference operator*() const {
         return parent::operator*();
 }
+pointer operator->() const {
+        return parent::operator->();
+}
+
+ConstIterator& operator++() {
+        Iterator::operator++();
+        return *this;
+}
+ConstIterator operator++(int){
+        ConstIterator it{*this};
+        ++(*this);
+        return it;
+}
+};
+
+//owns a node extracted from a tree and frees it through the tree's allocator unless it is inserted again
+template <class key, class value, class comparator, class aggregator, class Allocator>
+class BST<key, value, comparator, aggregator, Allocator>::NodeHandle {
+using node_ptr = BST<key, value, comparator, aggregator, Allocator>::node_ptr;
+
+//keeps the memory of a node laid out by compact() alive, declared first so that the node is destroyed before it
+std::shared_ptr<node_block> block;
+//an optional since moving a node_ptr into another one would keep the deleter of the target
+std::optional<node_ptr> owned;
+//the key of a node is const, so a changed key is kept here and insert builds a new node around it
+mutable std::optional<key> renamed;
+friend class BST<key, value, comparator, aggregator, Allocator>;
+
+NodeHandle(node_ptr n, std::shared_ptr<node_block> b) : block{std::move(b)} {
+        owned.emplace(std::move(n));
+}
+
+public:
+NodeHandle() = default;
+NodeHandle(NodeHandle&& rhs) noexcept {
+        *this = std::move(rhs);
+}
+NodeHandle& operator=(NodeHandle&& rhs) noexcept {
+        owned.reset();
+        block = std::move(rhs.block);
+        if (rhs.owned)
+                owned.emplace(std::move(*rhs.owned));
+        rhs.owned.reset();
+        renamed = std::move(rhs.renamed);
+        rhs.renamed.reset();
+        return *this;
+}
+
+bool empty() const {
+        return !owned;
+}
+explicit operator bool() const {
+        return !empty();
+}
+//the key may be changed before the node is inserted again
+key& mutable_key() const {
+        if (!renamed)
+                renamed.emplace((*owned)->data_pair.first);
+        return *renamed;
+}
+value& mapped() const {
+        return (*owned)->data_pair.second;
+}
+};
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+struct BST<key, value, comparator, aggregator, Allocator>::InsertReturn {
+        Iterator position;
+        bool inserted;
+        NodeHandle node;
 };
 
-template <class key, class value, class comparator>
-typename BST<key, value, comparator>::Iterator BST<key, value, comparator>::begin() {
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::NodeHandle BST<key, value, comparator, aggregator, Allocator>::extract(ConstIterator position){
+        node* n = position.current_node;
+        std::shared_ptr<node_block> block;
+        for (const auto& b : blocks)
+                if (b->holds(n))
+                        block = b;
+        return NodeHandle(unlink_node(n), std::move(block));
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::NodeHandle BST<key, value, comparator, aggregator, Allocator>::extract(Iterator position){
+        return extract(ConstIterator(position));
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+typename BST<key, value, comparator, aggregator, Allocator>::NodeHandle BST<key, value, comparator, aggregator, Allocator>::extract(const K& k){
+        ConstIterator found = static_cast<const BST&>(*this).find(k);
+        if (found == cend())
+                return NodeHandle();
+        return extract(found);
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::InsertReturn BST<key, value, comparator, aggregator, Allocator>::insert(NodeHandle&& handle){
+        if (handle.empty())
+                return InsertReturn{end(), false, NodeHandle()};
+        node_ptr& n = *handle.owned;
+        if (!(static_cast<const node_allocator&>(n.get_deleter()) == allocator))
+                throw std::runtime_error("tried inserting a node of a tree with a different allocator");
+        const key& k = handle.renamed ? *handle.renamed : n->data_pair.first;
+
+        node* parent = nullptr;
+        node_ptr* slot = &root_node;
+        while (*slot) {
+                parent = slot->get();
+                if (k == parent->data_pair.first)
+                        return InsertReturn{Iterator(parent), false, std::move(handle)};
+                slot = k < parent->data_pair.first ? &parent->left : &parent->right;
+        }
+        //a renamed node is rebuilt around its new key; the old one is freed before its block reference is dropped
+        if (handle.renamed) {
+                n = make_node(*handle.renamed, std::move(n->data_pair.second), parent);
+                handle.renamed.reset();
+                handle.block.reset();
+        }
+        //the value may have changed through mapped()
+        n->local_root = parent;
+        update_node(n.get());
+        if (handle.block) {
+                std::vector<std::shared_ptr<node_block> > from{std::move(handle.block)};
+                share_blocks(from);
+        }
+        *slot = std::move(n);
+        handle.owned.reset();
+        update_path(parent);
+        if (filter)
+                filter_new_key((*slot)->data_pair.first);
+        return InsertReturn{Iterator(slot->get()), true, NodeHandle()};
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::Iterator BST<key, value, comparator, aggregator, Allocator>::begin() {
         node* current = root_node.get();
-        while (current->left != nullptr) {
+        while (current != nullptr && current->left != nullptr) {
                 current = current->left.get();
         }
         return Iterator{current};
 }
 
 
-template <class key, class value, class comparator>
-typename BST<key, value, comparator>::ConstIterator BST<key, value, comparator>::cbegin() const {
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::ConstIterator BST<key, value, comparator, aggregator, Allocator>::cbegin() const {
         node* current = root_node.get();
-        while (current->left != nullptr) {
+        while (current != nullptr && current->left != nullptr) {
                 current = current->left.get();
         }
         return ConstIterator{current};
@@ -160,175 +1118,2718 @@ typename BST<key, value, comparator>::ConstIterator BST<key, value, comparator>:
 
 
 
-template <class key, class value, class comparator>
-void BST<key, value, comparator>::insert(const key k, value v){
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::node_ptr BST<key, value, comparator, aggregator, Allocator>::make_node(const std::pair<const key, value>& p, node* local_root){
+        node* n = node_traits::allocate(allocator, 1);
+        try {
+                node_traits::construct(allocator, n, p, local_root, node_deleter{allocator});
+        }
+        catch (...) {
+                node_traits::deallocate(allocator, n, 1);
+                throw;
+        }
+        return node_ptr(n, node_deleter{allocator});
+}
 
-        std::pair<const key, value> p(k, v);
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::node_ptr BST<key, value, comparator, aggregator, Allocator>::make_node(std::pair<const key, value>&& p, node* local_root){
+        return make_node(p.first, std::move(p.second), local_root);
+}
 
-        if (root_node==nullptr) {
-                std::unique_ptr<node> elem (new node{p, nullptr, nullptr, nullptr});
-                root_node=std::move(elem);
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class V>
+typename BST<key, value, comparator, aggregator, Allocator>::node_ptr BST<key, value, comparator, aggregator, Allocator>::make_node(const key& k, V&& v, node* local_root){
+        node* n = node_traits::allocate(allocator, 1);
+        try {
+                node_traits::construct(allocator, n, k, std::forward<V>(v), local_root, node_deleter{allocator});
         }
-        else{
-                add_node_recursive(p,root_node.get());
+        catch (...) {
+                node_traits::deallocate(allocator, n, 1);
+                throw;
         }
+        return node_ptr(n, node_deleter{allocator});
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::insert(const key& k, const value& v){
+        insert_node(k, v);
         //std::cout << "inserted node successfully" << std::endl;
 }
 
-template <class key, class value, class comparator>
-void BST<key, value, comparator>::add_node_recursive(std::pair<const key, value> p, node* current){
-        if (MyComparator(p, current->data_pair)==2) {
-                current->data_pair.second=p.second;
-                return;
+//returns the node now holding k, whether it was added or only got its value replaced
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::node* BST<key, value, comparator, aggregator, Allocator>::insert_node(const key& k, const value& v, node* start){
+        return insert_node(std::pair<const key, value>(k, v), start);
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::node* BST<key, value, comparator, aggregator, Allocator>::insert_node(std::pair<const key, value>&& p, node* start){
+        if (root_node==nullptr) {
+                node_ptr elem = make_node(std::move(p), nullptr);
+                root_node=std::move(elem);
+                if (filter)
+                        filter_new_key(root_node->data_pair.first);
+                return root_node.get();
         }
+        std::size_t old_size = size();
+        node* inserted = add_node_recursive(std::move(p), start ? start : root_node.get());
+        //a replaced value leaves the filter alone, so added counts the keys only once
+        if (filter && size() != old_size)
+                filter_new_key(inserted->data_pair.first);
+        return inserted;
+}
 
-        if (MyComparator(p, current->data_pair)==1) {
-                if (current->left == nullptr) {
-                        std::unique_ptr<node> elem (new node{p, nullptr, nullptr, current});
-                        current->left=std::move(elem);
-                        return;
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::Iterator BST<key, value, comparator, aggregator, Allocator>::insert(ConstIterator hint, const key& k, const value& v){
+        return insert_hinted(hint.current_node, std::pair<const key, value>(k, v));
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::node* BST<key, value, comparator, aggregator, Allocator>::insert_hinted(node* hint, std::pair<const key, value>&& p){
+        std::size_t old_size = size();
+        node* start = hint ? finger_subtree(hint, p.first) : nullptr;
+        node* inserted = insert_node(std::move(p), start);
+        if (size() == old_size)
+                return inserted;
+        std::size_t depth = 0;
+        for (node* n = inserted; n->local_root; n = n->local_root)
+                ++depth;
+        //above log_{3/2}(n) some ancestor holds more than 2/3 of its subtree in the child towards the new node
+        if (depth > std::log(double(size())) / std::log(1.5)) {
+                for (node* child = inserted; child->local_root; child = child->local_root) {
+                        if (3 * child->subtree_size > 2 * child->local_root->subtree_size) {
+                                rebuild_subtree(child->local_root);
+                                break;
+                        }
                 }
-                current= current->left.get();
         }
-        if (MyComparator(p, current->data_pair)==0) {
-                if (current->right == nullptr) {
-                        std::unique_ptr<node> elem (new node{p, nullptr, nullptr, current});
-                        current->right=std::move(elem);
-                        return;
+        return inserted;
+}
+
+//a node reached from its left child bounds the subtree below from above, one reached from its right child from below
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+typename BST<key, value, comparator, aggregator, Allocator>::node* BST<key, value, comparator, aggregator, Allocator>::finger_subtree(node* finger, const K& k) const {
+        if (k == finger->data_pair.first)
+                return finger;
+        bool above_finger = finger->data_pair.first < k;
+        bool passed_bound = false;
+        node* current = finger;
+        while (current->local_root) {
+                node* parent = current->local_root;
+                if ((parent->left.get() == current) == above_finger) {
+                        if (k == parent->data_pair.first)
+                                return parent;
+                        if ((k < parent->data_pair.first) == above_finger)
+                                return current;
+                        passed_bound = true;
                 }
-                current= current->right.get();
+                current = parent;
         }
-        add_node_recursive(p, current);
+        //without any ancestor beyond the finger on k's side, k's position is below the finger, as for appends past the maximum
+        return passed_bound ? current : finger;
 }
 
-template <class key, class value, class comparator>
-void BST<key, value, comparator>::clear() {
-        root_node=nullptr;
-        std::cout << "root_node reset" << std::endl;
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::node* BST<key, value, comparator, aggregator, Allocator>::add_node_recursive(std::pair<const key, value>&& p, node* current){
+        int comparison = MyComparator(p, current->data_pair);
+        if (comparison==2) {
+                current->data_pair.second=std::move(p.second);
+                update_path(current);
+                return current;
+        }
+
+        node_ptr& child = comparison==1 ? current->left : current->right;
+        if (child == nullptr) {
+                node_ptr elem = make_node(std::move(p), current);
+                child=std::move(elem);
+                update_path(current);
+                return child.get();
+        }
+        return add_node_recursive(std::move(p), child.get());
 }
 
-template <class key, class value, class comparator>
-void BST<key, value, comparator>::balance() {
-        if (root_node == nullptr) {
-                std::cout << "attempted balancing empty BST" << std::endl;
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class RandomIt, class KeyOf, class Visit>
+void BST<key, value, comparator, aggregator, Allocator>::insert_batch(RandomIt first, RandomIt last, KeyOf key_of, Visit visit){
+        //the filter is grown before the batch, for all of it, as its new keys are added while the nodes are created
+        if (filter) {
+                std::size_t incoming = last - first;
+                if (filter->added + incoming > filter->capacity) {
+                        filter->capacity = 2 * std::max(filter->capacity, size() + incoming);
+                        rebuild_filter();
+                }
+        }
+        insert_batch_recursive(root_node, nullptr, first, last, key_of, visit);
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class RandomIt, class KeyOf, class Visit>
+void BST<key, value, comparator, aggregator, Allocator>::insert_batch_recursive(node_ptr& slot, node* local_root, RandomIt first, RandomIt last, KeyOf& key_of, Visit& visit){
+        if (first == last)
                 return;
+        node* current = slot.get();
+        RandomIt middle, after;
+        if (current == nullptr) {
+                middle = first + (last - first) / 2;
+                after = middle + 1;
+                slot = make_node(std::pair<const key, value>(key_of(*middle), value{}), local_root);
+                current = slot.get();
+                if (filter)
+                        filter->add(current->data_pair.first);
+                visit(*middle, current);
         }
-        std::vector<std::pair<const key, value> > temp_container;
-        for (ConstIterator it = cbegin(); it != nullptr; ++it)
-                temp_container.push_back(*it);
-        clear();
-        balance_recursive(temp_container,0,temp_container.size());
+        else {
+                const key& k = current->data_pair.first;
+                middle = std::lower_bound(first, last, k, [&key_of](const auto& item, const key& k) {
+                        return key_of(item) < k;
+                });
+                after = middle;
+                if (middle != last && key_of(*middle) == k)
+                        visit(*after++, current);
+        }
+        insert_batch_recursive(current->left, current, first, middle, key_of, visit);
+        insert_batch_recursive(current->right, current, after, last, key_of, visit);
+        update_node(current);
+}
 
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::update_node(node* n){
+        n->subtree_size = 1 + subtree_size_of(n->left.get()) + subtree_size_of(n->right.get());
+        n->aggregate() = aggregator::combine(aggregator::combine(aggregate_of(n->left.get()), aggregator::lift(n->data_pair.second)),
+                                             aggregate_of(n->right.get()));
 }
 
-template <class key, class value, class comparator>
-void BST<key, value, comparator>::balance_recursive(std::vector<std::pair<const key, value> >& vec, std::size_t start, std::size_t end){
-        if(end-start==0) return;
-        std::size_t temp_mid = (start + end) / 2;
-        insert(vec[temp_mid].first,vec[temp_mid].second);
-        balance_recursive(vec, start, temp_mid);
-        balance_recursive(vec, temp_mid+1, end);
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::update_path(node* n){
+        for (; n != nullptr; n = n->local_root)
+                update_node(n);
 }
 
-template <class key, class value, class comparator>
-typename BST<key, value, comparator>::ConstIterator BST<key, value, comparator>::find(const key k) const {
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::node_ptr& BST<key, value, comparator, aggregator, Allocator>::owner_of(node* n){
+        if (n->local_root == nullptr)
+                return root_node;
+        if (n->local_root->left.get() == n)
+                return n->local_root->left;
+        return n->local_root->right;
+}
 
-        node* current=root_node.get();
-        while (current) {
-                if(k==current->data_pair.first) {
-                        //std::cout << "found a node with the given key" << std::endl;
-                        return ConstIterator(current);
+//lifts n above its local root, keeping local_root links and the augmentation of both nodes up to date
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::rotate_up(node* n){
+        node* parent = n->local_root;
+        node_ptr& parent_slot = owner_of(parent);
+        node_ptr parent_owned = std::move(parent_slot);
+        node_ptr n_owned = no_node();
+        if (parent->left.get() == n) {
+                n_owned = std::move(parent->left);
+                parent->left = std::move(n->right);
+                if (parent->left)
+                        parent->left->local_root = parent;
+                n->local_root = parent->local_root;
+                parent->local_root = n;
+                n->right = std::move(parent_owned);
+        }
+        else {
+                n_owned = std::move(parent->right);
+                parent->right = std::move(n->left);
+                if (parent->right)
+                        parent->right->local_root = parent;
+                n->local_root = parent->local_root;
+                parent->local_root = n;
+                n->left = std::move(parent_owned);
+        }
+        update_node(parent);
+        update_node(n);
+        parent_slot = std::move(n_owned);
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::splay(node* n){
+        while (n->local_root != nullptr) {
+                node* parent = n->local_root;
+                node* grandparent = parent->local_root;
+                if (grandparent == nullptr) {
+                        rotate_up(n);
                 }
-                else if (k > current->data_pair.first) {
+                else if ((grandparent->left.get() == parent) == (parent->left.get() == n)) {
+                        rotate_up(parent);
+                        if (splay_mode == SplayMode::semi)
+                                n = parent;
+                        else
+                                rotate_up(n);
+                }
+                else {
+                        rotate_up(n);
+                        rotate_up(n);
+                }
+        }
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+bool BST<key, value, comparator, aggregator, Allocator>::erase(const K& k){
+        node* current=root_node.get();
+        while (current && !(k==current->data_pair.first))
+                current = k > current->data_pair.first ? current->right.get() : current->left.get();
+        if (current == nullptr)
+                return false;
+        unlink_node(current);
+        return true;
+}
+
+//takes n out of the tree and hands over its ownership; the in-order successor of a node with two children moves into
+//its place, so no other node changes its pair and iterators to them stay valid
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::node_ptr BST<key, value, comparator, aggregator, Allocator>::unlink_node(node* current){
+        if constexpr (hashable_keys) {
+                if (cache) {
+                        typename lookup_cache::entry& cached = cache->slot(current->data_pair.first);
+                        if (cached.cached == current)
+                                cached = typename lookup_cache::entry{nullptr, 0};
+                }
+        }
+
+        node* parent = current->local_root;
+        node_ptr& slot = owner_of(current);
+        node_ptr removed = std::move(slot);
+        if (current->left == nullptr || current->right == nullptr) {
+                node_ptr child = std::move(current->left ? current->left : current->right);
+                if (child)
+                        child->local_root = parent;
+                slot = std::move(child);
+                update_path(parent);
+        }
+        else {
+                //two children: the in-order successor takes the place of the unlinked node
+                node* successor = current->right.get();
+                while (successor->left != nullptr)
+                        successor = successor->left.get();
+                node* fixup = successor->local_root == current ? successor : successor->local_root;
+
+                node_ptr& successor_slot = owner_of(successor);
+                node_ptr detached = std::move(successor_slot);
+                successor_slot = std::move(detached->right);
+                if (successor_slot)
+                        successor_slot->local_root = successor->local_root == current ? successor : successor->local_root;
+
+                detached->left = std::move(current->left);
+                detached->left->local_root = successor;
+                detached->right = std::move(current->right);
+                if (detached->right)
+                        detached->right->local_root = successor;
+                detached->local_root = parent;
+                slot = std::move(detached);
+                update_path(fixup);
+        }
+        removed->local_root = nullptr;
+        update_node(removed.get());
+        return removed;
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+std::size_t BST<key, value, comparator, aggregator, Allocator>::rank(const K& k) const {
+        std::size_t smaller = 0;
+        node* current=root_node.get();
+        while (current) {
+                if (k > current->data_pair.first) {
+                        smaller += subtree_size_of(current->left.get()) + 1;
                         current=current->right.get();
                 }
-                else{
+                else {
+                        current=current->left.get();
+                }
+        }
+        return smaller;
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::ConstIterator BST<key, value, comparator, aggregator, Allocator>::select(std::size_t i) const {
+        node* current=root_node.get();
+        while (current) {
+                std::size_t left_size = subtree_size_of(current->left.get());
+                if (i == left_size)
+                        return ConstIterator(current);
+                if (i < left_size) {
                         current=current->left.get();
                 }
+                else {
+                        i -= left_size + 1;
+                        current=current->right.get();
+                }
         }
-        std::cout << "key is not existing" << std::endl;
         return cend();
+}
 
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+std::size_t BST<key, value, comparator, aggregator, Allocator>::count_range(const K& a, const K& b) const {
+        if (!(a < b))
+                return 0;
+        return rank(b) - rank(a);
 }
 
-template <class key, class value, class comparator>
-std::ostream& operator<<(std::ostream& os, BST<key, value, comparator>& l) {
-        for (auto& data_pair : l)
-                os << data_pair.first << ": " << data_pair.second << std::endl;
-        return os;
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::clear() {
+        reset_nodes();
+        std::cout << "root_node reset" << std::endl;
 }
 
-template <class key, class value, class comparator>
-std::ostream& operator<<(std::ostream& os, const BST<key, value, comparator>& l) {
-        BST<int, int>::ConstIterator it  = l.cbegin();
-        for(; it!=nullptr; ++it)
-                os << (*it).first << ": " << (*it).second << std::endl;
-        return os;
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::reset_nodes() {
+        invalidate_cache();
+        root_node=nullptr;
+        blocks.clear();
+        rebuild_filter();
 }
 
-template <class key, class value, class comparator>
-value& BST<key, value, comparator>::operator[](const key& k){
-        Iterator temp = find(k);
-        if(temp != end()) return (*temp).second;
-        else{
-                insert(k, value{});
-                std::cout << "inserted missing key with value{}" << std::endl;
-                temp = find(k);
-                return (*temp).second;
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::balance() {
+        if (root_node == nullptr) {
+                std::cout << "attempted balancing empty BST" << std::endl;
+                return;
         }
+        std::vector<std::pair<const key, value> > temp_container;
+        temp_container.reserve(size());
+        for_each([&temp_container](const std::pair<const key, value>& p) {
+                temp_container.push_back(p);
+        });
+        reset_nodes();
+        root_node=balance_recursive(temp_container.begin(),0,temp_container.size(),nullptr);
+        rebuild_filter();
 
 }
 
-template <class key, class value, class comparator>
-const value& BST<key, value, comparator>::operator[](const key& k) const {
-        Iterator temp = find(k);
-        if(temp != cend()) return (*temp).second;
-        throw std::runtime_error("tried accessing not existing key in const BST");
+//builds the subtree of the sorted range [start, end) around its midpoint in O(end-start)
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class RandomIt>
+typename BST<key, value, comparator, aggregator, Allocator>::node_ptr BST<key, value, comparator, aggregator, Allocator>::balance_recursive(RandomIt sorted, std::size_t start, std::size_t end, node* local_root){
+        if(end-start==0) return no_node();
+        std::size_t temp_mid = (start + end) / 2;
+        node_ptr elem = make_node(sorted[temp_mid], local_root);
+        elem->left=balance_recursive(sorted, start, temp_mid, elem.get());
+        elem->right=balance_recursive(sorted, temp_mid+1, end, elem.get());
+        update_node(elem.get());
+        return elem;
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::record_access(node* n) const {
+        if (sampling_period != 0 && --sampling_countdown == 0) {
+                sampling_countdown = sampling_period;
+                if (n->hits != std::numeric_limits<std::uint32_t>::max())
+                        ++n->hits;
+        }
 }
 
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::set_bloom_filter(double false_positive_rate, std::size_t expected_keys){
+        if (false_positive_rate >= 1)
+                throw std::runtime_error("Bloom filter false positive rate has to be below 1");
+        if (false_positive_rate <= 0 || !hashable_keys) {
+                filter.reset();
+                return;
+        }
+        filter.reset(new bloom_filter(false_positive_rate, std::max(expected_keys, size())));
+        rebuild_filter();
+}
 
-//copy semantic
-template <class key, class value, class comparator>
-BST<key, value, comparator>::BST(const BST &bst_rhs){
-        root_node=nullptr;
-        MyComparator = Functor;
-        deepcopy_recursive(bst_rhs.root_node);
-        std::cout << "copy via constructor" << std::endl;
+//refills the filter from the keys in the tree, dropping the bits of erased keys
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::rebuild_filter(){
+        if (!filter)
+                return;
+        filter->reset(std::max(filter->capacity, size()));
+        for_each_node(root_node.get(), [this](node* n) {
+                filter->add(n->data_pair.first);
+        });
 }
 
-template <class key, class value, class comparator>
-BST<key, value, comparator>& BST<key, value, comparator>::operator=(const BST &bst_rhs){
-        if (this == &bst_rhs) {
-                std::cout << "self assignment" << std::endl;
-                return *this;
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+bool BST<key, value, comparator, aggregator, Allocator>::may_contain(const K& k) const {
+        if constexpr (std::is_same<K, key>::value && hashable_keys)
+                return !filter || filter->may_contain(k);
+        else
+                return true;
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::reset_access_counts(){
+        for_each_node(root_node.get(), [](node* n) {
+                n->hits = 0;
+        });
+}
+
+//relinks the existing nodes into a near-optimal tree for the sampled access counts (Mehlhorn's bisection rule);
+//every key also gets a quarter of the average hit count so that unsampled keys stay within a few levels of log2(n)
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::balance_weighted(){
+        std::vector<node*> nodes;
+        nodes.reserve(size());
+        for_each_node(root_node.get(), [&nodes](node* n) {
+                nodes.push_back(n);
+        });
+        if (nodes.empty())
+                return;
+
+        double total_hits = 0;
+        for (const auto n : nodes)
+                total_hits += n->hits;
+        double smoothing = std::max(total_hits, 1.0) / (4.0 * nodes.size());
+        std::vector<double> prefix(nodes.size() + 1, 0);
+        for (std::size_t i = 0; i < nodes.size(); ++i)
+                prefix[i+1] = prefix[i] + nodes[i]->hits + smoothing;
+
+        root_node.release();
+        for (const auto n : nodes) {
+                n->left.release();
+                n->right.release();
         }
-        clear();
-        deepcopy_recursive(bst_rhs.root_node);
-        std::cout << "copy via assignment" << std::endl;
-        return *this;
+        root_node=weighted_recursive(nodes, prefix, 0, nodes.size(), nullptr);
 }
 
-template <class key, class value, class comparator>
-void BST<key, value, comparator>::deepcopy_recursive(const std::unique_ptr<node>& node){
-        if(node!=nullptr)
-        {
-                insert(node->data_pair.first,node->data_pair.second);
-                deepcopy_recursive(node->left);
-                deepcopy_recursive(node->right);
+//the root of [start, end) is the node whose weight interval holds the midpoint of the range's weight; it is found by
+//galloping in from both ends, so each split costs O(log min(left size, right size)) and the whole build O(n)
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::node_ptr BST<key, value, comparator, aggregator, Allocator>::weighted_recursive(const std::vector<node*>& nodes, const std::vector<double>& prefix, std::size_t start, std::size_t end, node* local_root){
+        if(end-start==0) return no_node();
+        double target = (prefix[start] + prefix[end]) / 2;
+        std::size_t lo = start, hi = end - 1;
+        for (std::size_t step = 1; lo < hi; step *= 2) {
+                std::size_t probe = start + step - 1;
+                if (probe >= hi)
+                        break;
+                if (prefix[probe+1] >= target) {
+                        hi = probe;
+                        break;
+                }
+                lo = probe + 1;
+                probe = end - step;
+                if (probe <= lo)
+                        break;
+                if (prefix[probe+1] < target) {
+                        lo = probe + 1;
+                        break;
+                }
+                hi = probe;
         }
+        while (lo < hi) {
+                std::size_t mid = (lo + hi) / 2;
+                if (prefix[mid+1] >= target)
+                        hi = mid;
+                else
+                        lo = mid + 1;
+        }
+
+        node_ptr elem (nodes[lo], node_deleter{allocator});
+        elem->local_root = local_root;
+        elem->left=weighted_recursive(nodes, prefix, start, lo, elem.get());
+        elem->right=weighted_recursive(nodes, prefix, lo+1, end, elem.get());
+        update_node(elem.get());
+        return elem;
 }
 
-// move semantic
-template <class key, class value, class comparator>
-BST<key, value, comparator>::BST(BST&& bst_rhs) : root_node{std::move(bst_rhs.root_node)} {
-        std::cout << "move via constructor" << std::endl;
+//builds the subtree of the sorted nodes [start, end) around its midpoint, reusing the nodes
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::node_ptr BST<key, value, comparator, aggregator, Allocator>::relink_recursive(const std::vector<node*>& nodes, std::size_t start, std::size_t end, node* local_root){
+        if(end-start==0) return no_node();
+        std::size_t temp_mid = (start + end) / 2;
+        node_ptr elem (nodes[temp_mid], node_deleter{allocator});
+        elem->local_root = local_root;
+        elem->left=relink_recursive(nodes, start, temp_mid, elem.get());
+        elem->right=relink_recursive(nodes, temp_mid+1, end, elem.get());
+        update_node(elem.get());
+        return elem;
 }
 
-template <class key, class value, class comparator>
-BST<key, value, comparator>& BST<key, value, comparator>::operator=(BST&& bst_rhs){
-        root_node = std::move(bst_rhs.root_node);
-        std::cout << "move via assignment" << std::endl;
-        return *this;
+//relinks the subtree of n around its midpoints; sizes and aggregates above n stay as they are
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::rebuild_subtree(node* n){
+        node* local_root = n->local_root;
+        node_ptr& slot = owner_of(n);
+        std::vector<node*> nodes;
+        nodes.reserve(n->subtree_size);
+        for_each_node(n, [&nodes](node* m) {
+                nodes.push_back(m);
+        });
+        slot.release();
+        for (const auto m : nodes) {
+                m->left.release();
+                m->right.release();
+        }
+        slot = relink_recursive(nodes, 0, nodes.size(), local_root);
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+std::size_t BST<key, value, comparator, aggregator, Allocator>::tree_height() const {
+        std::size_t height = 0;
+        std::vector<std::pair<const node*, std::size_t> > stack;
+        if (root_node)
+                stack.emplace_back(root_node.get(), 1);
+        while (!stack.empty()) {
+                const node* current = stack.back().first;
+                std::size_t depth = stack.back().second;
+                stack.pop_back();
+                height = std::max(height, depth);
+                if (current->left)
+                        stack.emplace_back(current->left.get(), depth + 1);
+                if (current->right)
+                        stack.emplace_back(current->right.get(), depth + 1);
+        }
+        return height;
+}
+
+//appends the nodes of the top height levels below root in van Emde Boas order: the upper half of the levels first, then
+//each subtree hanging below it; bottoms is scratch space shared by all levels of the recursion
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::van_emde_boas_order(node* root, std::size_t height, std::vector<node*>& order, std::vector<node*>& bottoms){
+        if (root == nullptr)
+                return;
+        if (height == 1) {
+                order.push_back(root);
+                return;
+        }
+        std::size_t top = height / 2;
+        van_emde_boas_order(root, top, order, bottoms);
+
+        std::size_t first = bottoms.size();
+        bottoms.push_back(root);
+        for (std::size_t level = 0; level < top; ++level) {
+                std::size_t level_end = bottoms.size();
+                for (std::size_t i = first; i < level_end; ++i) {
+                        if (bottoms[i]->left)
+                                bottoms.push_back(bottoms[i]->left.get());
+                        if (bottoms[i]->right)
+                                bottoms.push_back(bottoms[i]->right.get());
+                }
+                bottoms.erase(bottoms.begin() + first, bottoms.begin() + level_end);
+        }
+        std::size_t last = bottoms.size();
+        for (std::size_t i = first; i < last; ++i)
+                van_emde_boas_order(bottoms[i], height - top, order, bottoms);
+        bottoms.resize(first);
+}
+
+//copies the nodes into a node_block in layout order, then relinks the copies through forwarding pointers left in the
+//local_root of the old nodes and frees those; the old blocks go with the last old node
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::compact(NodeLayout layout){
+        if (root_node == nullptr)
+                return;
+        invalidate_cache();
+        std::vector<node*> order;
+        order.reserve(size());
+        if (layout == NodeLayout::breadth_first) {
+                order.push_back(root_node.get());
+                for (std::size_t i = 0; i < order.size(); ++i) {
+                        if (order[i]->left)
+                                order.push_back(order[i]->left.get());
+                        if (order[i]->right)
+                                order.push_back(order[i]->right.get());
+                }
+        }
+        else {
+                std::vector<node*> bottoms;
+                van_emde_boas_order(root_node.get(), tree_height(), order, bottoms);
+        }
+
+        std::shared_ptr<node_block> block = std::allocate_shared<node_block>(allocator, allocator, order.size());
+        node* nodes = block->nodes;
+        constexpr bool move_values = std::is_nothrow_move_constructible<value>::value && std::is_nothrow_move_assignable<value>::value;
+        std::size_t built = 0;
+        try {
+                for (; built < order.size(); ++built) {
+                        std::pair<const key, value>& p = order[built]->data_pair;
+                        if constexpr (move_values)
+                                node_traits::construct(allocator, nodes + built, p.first, std::move(p.second), nullptr, node_deleter{allocator});
+                        else
+                                node_traits::construct(allocator, nodes + built, p.first, static_cast<const value&>(p.second), nullptr, node_deleter{allocator});
+                }
+        }
+        catch (...) {
+                for (std::size_t i = 0; i < built; ++i) {
+                        if constexpr (move_values)
+                                order[i]->data_pair.second = std::move(nodes[i].data_pair.second);
+                        node_traits::destroy(allocator, nodes + i);
+                }
+                throw;
+        }
+
+        for (std::size_t i = 0; i < order.size(); ++i) {
+                nodes[i].subtree_size = order[i]->subtree_size;
+                nodes[i].hits = order[i]->hits;
+                nodes[i].aggregate() = order[i]->aggregate();
+                nodes[i].in_block = 1;
+                order[i]->local_root = nodes + i;
+        }
+        for (std::size_t i = 0; i < order.size(); ++i) {
+                if (order[i]->left) {
+                        nodes[i].left.reset(order[i]->left->local_root);
+                        nodes[i].left->local_root = nodes + i;
+                }
+                if (order[i]->right) {
+                        nodes[i].right.reset(order[i]->right->local_root);
+                        nodes[i].right->local_root = nodes + i;
+                }
+        }
+
+        root_node.release();
+        for (const auto n : order) {
+                n->left.release();
+                n->right.release();
+        }
+        for (const auto n : order)
+                node_deleter{allocator}(n);
+        root_node.reset(nodes);
+        blocks.clear();
+        blocks.push_back(std::move(block));
+}
+
+//hands out the nodes in key order and empties the tree without freeing them
+template <class key, class value, class comparator, class aggregator, class Allocator>
+std::vector<typename BST<key, value, comparator, aggregator, Allocator>::node*> BST<key, value, comparator, aggregator, Allocator>::release_nodes(){
+        invalidate_cache();
+        std::vector<node*> nodes;
+        nodes.reserve(size());
+        for_each_node(root_node.get(), [&nodes](node* n) {
+                nodes.push_back(n);
+        });
+        root_node.release();
+        for (const auto n : nodes) {
+                n->left.release();
+                n->right.release();
+        }
+        rebuild_filter();
+        return nodes;
+}
+
+//walks down once, hanging each node on the right spine of the lower tree or the left spine of the upper tree
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+std::pair<BST<key, value, comparator, aggregator, Allocator>, BST<key, value, comparator, aggregator, Allocator> > BST<key, value, comparator, aggregator, Allocator>::split(const K& k){
+        std::pair<BST, BST> parts(std::piecewise_construct, std::forward_as_tuple(get_allocator()), std::forward_as_tuple(get_allocator()));
+        invalidate_cache();
+        node_ptr* lower_hook = &parts.first.root_node;
+        node_ptr* upper_hook = &parts.second.root_node;
+        node* lower_parent = nullptr;
+        node* upper_parent = nullptr;
+        node_ptr current = std::move(root_node);
+        while (current) {
+                node* n = current.get();
+                node_ptr next = no_node();
+                if (n->data_pair.first < k) {
+                        next = std::move(n->right);
+                        n->local_root = lower_parent;
+                        *lower_hook = std::move(current);
+                        lower_hook = &n->right;
+                        lower_parent = n;
+                }
+                else {
+                        next = std::move(n->left);
+                        n->local_root = upper_parent;
+                        *upper_hook = std::move(current);
+                        upper_hook = &n->left;
+                        upper_parent = n;
+                }
+                current = std::move(next);
+        }
+        update_path(lower_parent);
+        update_path(upper_parent);
+        parts.first.blocks = blocks;
+        parts.second.blocks = blocks;
+        blocks.clear();
+        rebuild_filter();
+        parts.first.copy_settings(*this);
+        parts.second.copy_settings(*this);
+        return parts;
+}
+
+//the largest node of left becomes the root, with the rest of left below it on the left and right on the right
+template <class key, class value, class comparator, class aggregator, class Allocator>
+BST<key, value, comparator, aggregator, Allocator> BST<key, value, comparator, aggregator, Allocator>::join(BST&& left, BST&& right){
+        //the checks come before any node or block changes hands, so a rejected join leaves both trees as they were
+        node* largest = left.root_node.get();
+        if (largest && right.root_node) {
+                while (largest->right != nullptr)
+                        largest = largest->right.get();
+                node* smallest = right.root_node.get();
+                while (smallest->left != nullptr)
+                        smallest = smallest->left.get();
+                if (!(largest->data_pair.first < smallest->data_pair.first))
+                        throw std::runtime_error("tried joining BSTs with interleaving keys");
+        }
+        //right's nodes under an unequal allocator are copied into one of left's first
+        bool copy_right = !(left.allocator == right.allocator);
+        BST copied(left.get_allocator());
+        if (copy_right)
+                copied.take_over(std::move(right));
+        BST& upper = copy_right ? copied : right;
+        BST joined(left.get_allocator());
+        joined.copy_settings(left);
+        left.invalidate_cache();
+        upper.invalidate_cache();
+        joined.share_blocks(left.blocks);
+        joined.share_blocks(upper.blocks);
+        if (left.root_node == nullptr || upper.root_node == nullptr) {
+                joined.root_node = std::move(left.root_node ? left.root_node : upper.root_node);
+                joined.rebuild_filter();
+                return joined;
+        }
+
+        node_ptr& slot = left.owner_of(largest);
+        node_ptr detached = std::move(slot);
+        slot = std::move(largest->left);
+        if (slot)
+                slot->local_root = largest->local_root;
+        left.update_path(largest->local_root);
+
+        detached->left = std::move(left.root_node);
+        if (detached->left)
+                detached->left->local_root = largest;
+        detached->right = std::move(upper.root_node);
+        detached->right->local_root = largest;
+        detached->local_root = nullptr;
+        joined.update_node(largest);
+        joined.root_node = std::move(detached);
+        left.rebuild_filter();
+        upper.rebuild_filter();
+        joined.rebuild_filter();
+        return joined;
+}
+
+//a linear merge of both node sequences, relinked into a balanced tree; nodes of duplicate keys in other are freed
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::merge(BST& other){
+        if (this == &other)
+                return;
+        std::vector<node*> own_nodes = release_nodes();
+        std::vector<node*> other_nodes = other.release_nodes();
+        //nodes of an unequal allocator are rebuilt under this tree's one, so values are moved, never copied
+        if (allocator == other.allocator)
+                share_blocks(other.blocks);
+        else {
+                for (auto& n : other_nodes) {
+                        node* rebuilt = make_node(n->data_pair.first, std::move(n->data_pair.second), nullptr).release();
+                        rebuilt->hits = n->hits;
+                        node_deleter{other.allocator}(n);
+                        n = rebuilt;
+                }
+                other.blocks.clear();
+        }
+        std::vector<node*> merged;
+        merged.reserve(own_nodes.size() + other_nodes.size());
+        std::size_t i = 0, j = 0;
+        while (i < own_nodes.size() || j < other_nodes.size()) {
+                if (j == other_nodes.size() || (i < own_nodes.size() && own_nodes[i]->data_pair.first < other_nodes[j]->data_pair.first)) {
+                        merged.push_back(own_nodes[i++]);
+                }
+                else if (i == own_nodes.size() || other_nodes[j]->data_pair.first < own_nodes[i]->data_pair.first) {
+                        merged.push_back(other_nodes[j++]);
+                }
+                else {
+                        own_nodes[i]->data_pair.second = std::move(other_nodes[j]->data_pair.second);
+                        merged.push_back(own_nodes[i++]);
+                        node_deleter{allocator}(other_nodes[j++]);
+                }
+        }
+        root_node = relink_recursive(merged, 0, merged.size(), nullptr);
+        rebuild_filter();
+}
+
+//average number of nodes visited by a successful find, weighted by the sampled access counts
+template <class key, class value, class comparator, class aggregator, class Allocator>
+double BST<key, value, comparator, aggregator, Allocator>::weighted_path_length() const {
+        double weighted_depth = 0;
+        double total_hits = 0;
+        std::vector<std::pair<const node*, std::size_t> > stack;
+        if (root_node)
+                stack.emplace_back(root_node.get(), 1);
+        while (!stack.empty()) {
+                const node* current = stack.back().first;
+                std::size_t depth = stack.back().second;
+                stack.pop_back();
+                weighted_depth += double(current->hits) * depth;
+                total_hits += current->hits;
+                if (current->left)
+                        stack.emplace_back(current->left.get(), depth + 1);
+                if (current->right)
+                        stack.emplace_back(current->right.get(), depth + 1);
+        }
+        return total_hits > 0 ? weighted_depth / total_hits : 0;
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::save(const std::string& path) const {
+        static_assert(std::is_trivially_copyable<key>::value && std::is_trivially_copyable<value>::value, "snapshots need trivially copyable key and value types");
+        using record = std::pair<const key, value>;
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+                throw std::runtime_error("could not open snapshot " + path + " for writing");
+
+        BSTSnapshotHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, BSTSnapshotMagic, sizeof(header.magic));
+        header.version = BSTSnapshotVersion;
+        header.key_size = sizeof(key);
+        header.value_size = sizeof(value);
+        header.record_size = sizeof(record);
+        header.count = size();
+        header.checksum = snapshot_checksum(nullptr, 0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        //records are staged in a zeroed buffer so that padding bytes are deterministic for the checksum
+        std::vector<char> buffer;
+        buffer.reserve(sizeof(record) * 4096);
+        auto flush = [&file, &buffer, &header]() {
+                header.checksum = snapshot_checksum(buffer.data(), buffer.size(), header.checksum);
+                file.write(buffer.data(), buffer.size());
+                buffer.clear();
+        };
+        for_each([&buffer, &flush](const record& data_pair) {
+                std::size_t offset = buffer.size();
+                buffer.resize(offset + sizeof(record), 0);
+                new (buffer.data() + offset) record(data_pair);
+                if (buffer.size() == buffer.capacity())
+                        flush();
+        });
+        flush();
+
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!file)
+                throw std::runtime_error("could not write snapshot " + path);
+}
+
+//rebuilds the tree in O(n) from the sorted records of a snapshot
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::load(const std::string& path){
+        BSTSnapshot<key, value> snapshot(path);
+        invalidate_cache();
+        root_node=balance_recursive(snapshot.begin(), 0, snapshot.size(), nullptr);
+        blocks.clear();
+        rebuild_filter();
+}
+
+//replaces the contents by a balanced tree over a range of pairs with strictly increasing keys, in O(n)
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class RandomIt>
+void BST<key, value, comparator, aggregator, Allocator>::assign_sorted(RandomIt first, RandomIt last){
+        invalidate_cache();
+        root_node=balance_recursive(first, 0, last - first, nullptr);
+        blocks.clear();
+        rebuild_filter();
+}
+
+//parses one "key value" line, the two numbers separated by blanks, a comma or a semicolon
+template <class key, class value>
+bool parse_text_line(const char* current, const char* line_end, key& k, value& v){
+        auto is_blank = [](char c) {
+                return c == ' ' || c == '\t' || c == '\r';
+        };
+        while (current != line_end && is_blank(*current))
+                ++current;
+        std::from_chars_result result = std::from_chars(current, line_end, k);
+        if (result.ec != std::errc())
+                return false;
+        current = result.ptr;
+        while (current != line_end && (is_blank(*current) || *current == ',' || *current == ';'))
+                ++current;
+        result = std::from_chars(current, line_end, v);
+        if (result.ec != std::errc())
+                return false;
+        current = result.ptr;
+        while (current != line_end && is_blank(*current))
+                ++current;
+        return current == line_end;
+}
+
+//reads numeric "key value" lines from a mapped file and bulk-builds the tree, sorting only if the input is not sorted already
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::load_text(const std::string& path){
+        static_assert(std::is_arithmetic<key>::value && std::is_arithmetic<value>::value, "text loading needs arithmetic key and value types");
+        MappedFile file(path, MADV_SEQUENTIAL);
+        const char* current = file.data();
+        const char* last = current + file.size();
+
+        std::vector<std::pair<key, value> > records;
+        records.reserve(std::count(current, last, '\n') + 1);
+        bool sorted = true;
+        for (std::size_t line = 1; current < last; ++line) {
+                const char* line_end = static_cast<const char*>(std::memchr(current, '\n', last - current));
+                if (line_end == nullptr)
+                        line_end = last;
+                const char* first_char = current;
+                while (first_char != line_end && (*first_char == ' ' || *first_char == '\t' || *first_char == '\r'))
+                        ++first_char;
+                if (first_char != line_end) {
+                        key k;
+                        value v;
+                        if (!parse_text_line(first_char, line_end, k, v))
+                                throw std::runtime_error("malformed line " + std::to_string(line) + " in " + path);
+                        if (!records.empty() && !(records.back().first < k))
+                                sorted = false;
+                        records.emplace_back(k, v);
+                }
+                current = line_end + 1;
+        }
+
+        if (!sorted) {
+                std::stable_sort(records.begin(), records.end(), [](const std::pair<key, value>& lhs, const std::pair<key, value>& rhs) {
+                        return lhs.first < rhs.first;
+                });
+                //like repeated inserts, the last line of a duplicated key wins
+                std::size_t kept = 0;
+                for (std::size_t i = 0; i < records.size(); ++i) {
+                        if (i + 1 < records.size() && !(records[i].first < records[i+1].first))
+                                continue;
+                        records[kept++] = records[i];
+                }
+                records.resize(kept);
+        }
+        assign_sorted(records.begin(), records.end());
+}
+
+//in-order traversal with an explicit stack of pending local roots instead of climbing local_root links
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class F>
+void BST<key, value, comparator, aggregator, Allocator>::for_each_node(node* current, F f){
+        std::vector<node*> stack;
+        stack.reserve(64);
+        while (current != nullptr || !stack.empty()) {
+                while (current != nullptr) {
+                        stack.push_back(current);
+                        current=current->left.get();
+                }
+                current=stack.back();
+                stack.pop_back();
+                f(current);
+                current=current->right.get();
+        }
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class F, bool M, typename std::enable_if<M, int>::type>
+void BST<key, value, comparator, aggregator, Allocator>::for_each(F f){
+        for_each_node(root_node.get(), [&f](node* n) {
+                f(n->data_pair);
+        });
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class F>
+void BST<key, value, comparator, aggregator, Allocator>::for_each(F f) const {
+        for_each_node(root_node.get(), [&f](const node* n) {
+                f(static_cast<const std::pair<const key, value>&>(n->data_pair));
+        });
+}
+
+//splits along subtree sizes until every piece holds at most grain nodes, keeping the pieces in key order
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::collect_pieces(node* current, std::size_t grain, std::vector<piece>& pieces) const {
+        if (current == nullptr)
+                return;
+        if (current->subtree_size <= grain) {
+                pieces.push_back(piece{current, true});
+                return;
+        }
+        collect_pieces(current->left.get(), grain, pieces);
+        pieces.push_back(piece{current, false});
+        collect_pieces(current->right.get(), grain, pieces);
+}
+
+//workers pull the next piece from a shared counter, so threads that finish early take over the remaining work
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class Task>
+void BST<key, value, comparator, aggregator, Allocator>::run_tasks(std::size_t tasks, unsigned threads, Task task){
+        if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+        std::atomic<std::size_t> next_task{0};
+        auto worker = [&next_task, tasks, &task]() {
+                for (std::size_t i = next_task++; i < tasks; i = next_task++)
+                        task(i);
+        };
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < threads && t < tasks; ++t)
+                pool.emplace_back(worker);
+        worker();
+        for (auto& thread : pool)
+                thread.join();
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class F>
+void BST<key, value, comparator, aggregator, Allocator>::parallel_for_each(F f, unsigned threads){
+        static_assert(mutable_values, "values of an aggregating tree change through insert, which refreshes the aggregates");
+        std::vector<piece> pieces;
+        unsigned workers = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+        collect_pieces(root_node.get(), std::max<std::size_t>(1, size() / (8 * workers)), pieces);
+        run_tasks(pieces.size(), workers, [&pieces, &f](std::size_t i) {
+                if (pieces[i].whole_subtree)
+                        for_each_node(pieces[i].root, [&f](node* n) {
+                                f(n->data_pair);
+                        });
+                else
+                        f(pieces[i].root->data_pair);
+        });
+}
+
+//partial results are combined in key order, so the result does not depend on scheduling for an associative op
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class T, class Reduce, class Transform>
+T BST<key, value, comparator, aggregator, Allocator>::parallel_transform_reduce(T init, Reduce op, Transform transform, unsigned threads) const {
+        std::vector<piece> pieces;
+        unsigned workers = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+        collect_pieces(root_node.get(), std::max<std::size_t>(1, size() / (8 * workers)), pieces);
+        std::vector<T> partial(pieces.size(), init);
+        run_tasks(pieces.size(), workers, [&pieces, &partial, &op, &transform](std::size_t i) {
+                if (!pieces[i].whole_subtree) {
+                        partial[i] = transform(pieces[i].root->data_pair);
+                        return;
+                }
+                bool empty = true;
+                T result = partial[i];
+                for_each_node(pieces[i].root, [&empty, &result, &op, &transform](const node* n) {
+                        if (empty)
+                                result = transform(n->data_pair);
+                        else
+                                result = op(result, transform(n->data_pair));
+                        empty = false;
+                });
+                partial[i] = result;
+        });
+        for (const auto& result : partial)
+                init = op(init, result);
+        return init;
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class T, class Reduce>
+T BST<key, value, comparator, aggregator, Allocator>::parallel_reduce(T init, Reduce op, unsigned threads) const {
+        return parallel_transform_reduce(init, op, [](const std::pair<const key, value>& data_pair) {
+                return data_pair.second;
+        }, threads);
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+typename BST<key, value, comparator, aggregator, Allocator>::ConstIterator BST<key, value, comparator, aggregator, Allocator>::find(const K& k) const {
+
+        //the cache and the Bloom filter are keyed by key's hash, so only lookups by key itself go through them
+        if constexpr (std::is_same<K, key>::value && hashable_keys) {
+                if (cache) {
+                        typename lookup_cache::entry& cached = cache->slot(k);
+                        if (cached.generation == cache->generation && k==cached.cached->data_pair.first) {
+                                ++cache->hits;
+                                record_access(cached.cached);
+                                return ConstIterator(cached.cached);
+                        }
+                        ++cache->misses;
+                }
+                if (filter && !filter->may_contain(k))
+                        return cend();
+        }
+
+        node* current=root_node.get();
+        while (current) {
+                if(k==current->data_pair.first) {
+                        //std::cout << "found a node with the given key" << std::endl;
+                        if constexpr (std::is_same<K, key>::value && hashable_keys) {
+                                if (cache)
+                                        cache->slot(k) = typename lookup_cache::entry{current, cache->generation};
+                        }
+                        record_access(current);
+                        return ConstIterator(current);
+                }
+                else if (k > current->data_pair.first) {
+                        current=current->right.get();
+                }
+                else{
+                        current=current->left.get();
+                }
+        }
+        return cend();
+
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+typename BST<key, value, comparator, aggregator, Allocator>::ConstIterator BST<key, value, comparator, aggregator, Allocator>::find_from(ConstIterator finger, const K& k) const {
+        if (finger.current_node == nullptr)
+                return find(k);
+        node* current = finger_subtree(finger.current_node, k);
+        while (current) {
+                if (k == current->data_pair.first) {
+                        record_access(current);
+                        return ConstIterator(current);
+                }
+                current = k < current->data_pair.first ? current->left.get() : current->right.get();
+        }
+        return cend();
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class RandomIt, class OutputIt>
+void BST<key, value, comparator, aggregator, Allocator>::find_sorted_recursive(node* current, RandomIt first, RandomIt last, OutputIt& out) const {
+        if (first == last)
+                return;
+        if (current == nullptr) {
+                for (; first != last; ++first)
+                        *out++ = cend();
+                return;
+        }
+        const key& k = current->data_pair.first;
+        RandomIt middle = std::lower_bound(first, last, k, [](const auto& query, const key& k) {
+                return query < k;
+        });
+        find_sorted_recursive(current->left.get(), first, middle, out);
+        if (middle != last && *middle == k) {
+                record_access(current);
+                for (; middle != last && *middle == k; ++middle)
+                        *out++ = ConstIterator(current);
+        }
+        find_sorted_recursive(current->right.get(), middle, last, out);
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+typename BST<key, value, comparator, aggregator, Allocator>::Iterator BST<key, value, comparator, aggregator, Allocator>::find(const K& k){
+        Iterator found = static_cast<const BST&>(*this).find(k);
+        if (found != end() && splay_mode != SplayMode::off && --splay_countdown == 0) {
+                splay_countdown = splay_period;
+                splay(found.current_node);
+        }
+        return found;
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+typename BST<key, value, comparator, aggregator, Allocator>::ConstIterator BST<key, value, comparator, aggregator, Allocator>::lower_bound(const K& k) const {
+        node* current=root_node.get();
+        node* candidate=nullptr;
+        while (current) {
+                if (current->data_pair.first < k) {
+                        current=current->right.get();
+                }
+                else {
+                        candidate=current;
+                        current=current->left.get();
+                }
+        }
+        return ConstIterator(candidate);
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+typename BST<key, value, comparator, aggregator, Allocator>::ConstIterator BST<key, value, comparator, aggregator, Allocator>::upper_bound(const K& k) const {
+        node* current=root_node.get();
+        node* candidate=nullptr;
+        while (current) {
+                if (k < current->data_pair.first) {
+                        candidate=current;
+                        current=current->left.get();
+                }
+                else {
+                        current=current->right.get();
+                }
+        }
+        return ConstIterator(candidate);
+}
+
+//folds the aggregates of all keys in [a, b) in key order along the two boundary paths
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+typename BST<key, value, comparator, aggregator, Allocator>::aggregate_type BST<key, value, comparator, aggregator, Allocator>::reduce(const K& a, const K& b) const {
+        node* split=root_node.get();
+        while (split) {
+                if (split->data_pair.first < a)
+                        split=split->right.get();
+                else if (!(split->data_pair.first < b))
+                        split=split->left.get();
+                else
+                        break;
+        }
+        if (split == nullptr)
+                return aggregator::identity();
+
+        aggregate_type suffix = aggregator::identity();
+        for (node* current=split->left.get(); current; ) {
+                if (current->data_pair.first < a) {
+                        current=current->right.get();
+                }
+                else {
+                        suffix = aggregator::combine(aggregator::combine(aggregator::lift(current->data_pair.second), aggregate_of(current->right.get())), suffix);
+                        current=current->left.get();
+                }
+        }
+        aggregate_type prefix = aggregator::identity();
+        for (node* current=split->right.get(); current; ) {
+                if (current->data_pair.first < b) {
+                        prefix = aggregator::combine(prefix, aggregator::combine(aggregate_of(current->left.get()), aggregator::lift(current->data_pair.second)));
+                        current=current->right.get();
+                }
+                else {
+                        current=current->left.get();
+                }
+        }
+        return aggregator::combine(aggregator::combine(suffix, aggregator::lift(split->data_pair.second)), prefix);
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+std::ostream& operator<<(std::ostream& os, BST<key, value, comparator, aggregator, Allocator>& l) {
+        const BST<key, value, comparator, aggregator, Allocator>& const_l = l;
+        return os << const_l;
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+std::ostream& operator<<(std::ostream& os, const BST<key, value, comparator, aggregator, Allocator>& l) {
+        l.for_each([&os](const std::pair<const key, value>& data_pair) {
+                os << data_pair.first << ": " << data_pair.second << std::endl;
+        });
+        return os;
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K, bool M, typename std::enable_if<M, int>::type>
+value& BST<key, value, comparator, aggregator, Allocator>::operator[](const K& k){
+        Iterator temp = find(k);
+        if(temp != end()) return (*temp).second;
+        else{
+                insert(key(k), value{});
+                std::cout << "inserted missing key with value{}" << std::endl;
+                temp = find(k);
+                return (*temp).second;
+        }
+
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+template <class K>
+const value& BST<key, value, comparator, aggregator, Allocator>::operator[](const K& k) const {
+        Iterator temp = find(k);
+        if(temp != cend()) return (*temp).second;
+        throw std::runtime_error("tried accessing not existing key in const BST");
+}
+
+
+//copy semantic
+//like the standard containers, a copy asks the source allocator which allocator it gets
+template <class key, class value, class comparator, class aggregator, class Allocator>
+BST<key, value, comparator, aggregator, Allocator>::BST(const BST &bst_rhs) :
+        BST(bst_rhs, Allocator(node_traits::select_on_container_copy_construction(bst_rhs.allocator))) {}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+BST<key, value, comparator, aggregator, Allocator>::BST(const BST &bst_rhs, const Allocator& alloc) : allocator{alloc}, root_node{nullptr, node_deleter{allocator}} {
+        root_node=nullptr;
+        MyComparator = Functor;
+        set_splay_mode(bst_rhs.splay_mode, bst_rhs.splay_period);
+        set_access_sampling(bst_rhs.sampling_period);
+        set_lookup_cache(bst_rhs.cache ? bst_rhs.cache->entries.size() : 0);
+        root_node=deepcopy_recursive(bst_rhs.root_node, nullptr);
+        set_bloom_filter(bst_rhs.bloom_filter_rate(), bst_rhs.filter ? bst_rhs.filter->capacity : 0);
+        std::cout << "copy via constructor" << std::endl;
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+BST<key, value, comparator, aggregator, Allocator>& BST<key, value, comparator, aggregator, Allocator>::operator=(const BST &bst_rhs){
+        if (this == &bst_rhs) {
+                std::cout << "self assignment" << std::endl;
+                return *this;
+        }
+        clear();
+        set_splay_mode(bst_rhs.splay_mode, bst_rhs.splay_period);
+        set_access_sampling(bst_rhs.sampling_period);
+        set_lookup_cache(bst_rhs.cache ? bst_rhs.cache->entries.size() : 0);
+        root_node=deepcopy_recursive(bst_rhs.root_node, nullptr);
+        set_bloom_filter(bst_rhs.bloom_filter_rate(), bst_rhs.filter ? bst_rhs.filter->capacity : 0);
+        std::cout << "copy via assignment" << std::endl;
+        return *this;
+}
+
+//clones the shape of the source tree directly, no comparisons or re-insertion needed
+template <class key, class value, class comparator, class aggregator, class Allocator>
+typename BST<key, value, comparator, aggregator, Allocator>::node_ptr BST<key, value, comparator, aggregator, Allocator>::deepcopy_recursive(const node_ptr& source, node* local_root){
+        if(source==nullptr)
+                return no_node();
+        node_ptr elem = make_node(source->data_pair, local_root);
+        elem->hits=source->hits;
+        elem->left=deepcopy_recursive(source->left, elem.get());
+        elem->right=deepcopy_recursive(source->right, elem.get());
+        update_node(elem.get());
+        return elem;
+}
+
+// move semantic
+template <class key, class value, class comparator, class aggregator, class Allocator>
+BST<key, value, comparator, aggregator, Allocator>::BST(BST&& bst_rhs) : allocator{bst_rhs.allocator}, blocks{std::move(bst_rhs.blocks)}, root_node{std::move(bst_rhs.root_node)}, filter{std::move(bst_rhs.filter)} {
+        MyComparator = Functor;
+        set_splay_mode(bst_rhs.splay_mode, bst_rhs.splay_period);
+        set_access_sampling(bst_rhs.sampling_period);
+        set_lookup_cache(bst_rhs.cache ? bst_rhs.cache->entries.size() : 0);
+        bst_rhs.invalidate_cache();
+        std::cout << "move via constructor" << std::endl;
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+BST<key, value, comparator, aggregator, Allocator>& BST<key, value, comparator, aggregator, Allocator>::operator=(BST&& bst_rhs){
+        //a self-move must keep the blocks, which still hold the nodes
+        if (this == &bst_rhs) {
+                std::cout << "self assignment" << std::endl;
+                return *this;
+        }
+        take_over(std::move(bst_rhs));
+        std::cout << "move via assignment" << std::endl;
+        return *this;
+}
+
+template <class key, class value, class comparator, class aggregator, class Allocator>
+void BST<key, value, comparator, aggregator, Allocator>::take_over(BST&& bst_rhs){
+        if (this == &bst_rhs)
+                return;
+        invalidate_cache();
+        bst_rhs.invalidate_cache();
+        //allocators are never propagated: nodes change hands between equal allocators and are copied otherwise
+        if (allocator == bst_rhs.allocator) {
+                root_node = std::move(bst_rhs.root_node);
+                blocks = std::move(bst_rhs.blocks);
+        }
+        else {
+                root_node = deepcopy_recursive(bst_rhs.root_node, nullptr);
+                blocks.clear();
+                bst_rhs.root_node = nullptr;
+                bst_rhs.blocks.clear();
+        }
+        filter = std::move(bst_rhs.filter);
+        set_splay_mode(bst_rhs.splay_mode, bst_rhs.splay_period);
+        set_access_sampling(bst_rhs.sampling_period);
+        set_lookup_cache(bst_rhs.cache ? bst_rhs.cache->entries.size() : 0);
+}
+
+template <class key, class value, class aggregator>
+using AggregateBST = BST<key, value, decltype(& Functor<const key,value>), aggregator>;
+
+//nodes come from a std::pmr::memory_resource, e.g. a monotonic_buffer_resource for short-lived trees
+template <class key, class value, class aggregator = NoAggregation<value> >
+using PmrBST = BST<key, value, decltype(& Functor<const key,value>), aggregator, std::pmr::polymorphic_allocator<std::pair<const key, value> > >;
+
+//ordered map for point-lookup heavy workloads: the BST keeps key order for iteration and range queries, an open-addressing
+//index from key to node answers find and operator[] in expected O(1) without walking the tree
+template <class key, class value, class hash = std::hash<key> >
+class HashIndexedBST
+{
+private:
+using tree_type = BST<key, value>;
+using node = typename tree_type::node;
+
+//linear probing on the high bits of the mixed hash; the full hash is kept so that probes and rehashing rarely touch a node
+struct entry {
+        std::uint64_t mixed;
+        node* indexed;
+};
+
+tree_type tree;
+std::vector<entry> slots;
+unsigned shift = 64;
+std::size_t live = 0;
+
+std::uint64_t hash_of(const key& k) const {
+        return static_cast<std::uint64_t>(hash{}(k)) * 0x9E3779B97F4A7C15ULL;
+}
+std::size_t home_of(std::uint64_t h) const {
+        return h >> shift;
+}
+std::size_t mask() const {
+        return slots.size() - 1;
+}
+std::size_t locate(const key& k) const;
+void index_node(std::uint64_t h, node* n);
+void unindex_slot(std::size_t i);
+void rehash(std::size_t capacity);
+void rebuild_index();
+void reset_index() {
+        slots.clear();
+        shift = 64;
+        live = 0;
+}
+
+public:
+using Iterator = typename tree_type::Iterator;
+using ConstIterator = typename tree_type::ConstIterator;
+
+HashIndexedBST() = default;
+HashIndexedBST(const HashIndexedBST& rhs) : tree{rhs.tree} {
+        rebuild_index();
+}
+HashIndexedBST& operator=(const HashIndexedBST& rhs) {
+        if (this != &rhs) {
+                tree = rhs.tree;
+                rebuild_index();
+        }
+        return *this;
+}
+//moving keeps the nodes, so the index moves along with the tree
+HashIndexedBST(HashIndexedBST&& rhs) : tree{std::move(rhs.tree)}, slots{std::move(rhs.slots)}, shift{rhs.shift}, live{rhs.live} {
+        rhs.reset_index();
+}
+HashIndexedBST& operator=(HashIndexedBST&& rhs) {
+        if (this != &rhs) {
+                tree = std::move(rhs.tree);
+                slots = std::move(rhs.slots);
+                shift = rhs.shift;
+                live = rhs.live;
+                rhs.reset_index();
+        }
+        return *this;
+}
+
+Iterator begin() {
+        return tree.begin();
+}
+Iterator end() {
+        return tree.end();
+}
+ConstIterator begin() const {
+        return tree.cbegin();
+}
+ConstIterator end() const {
+        return tree.cend();
+}
+ConstIterator cbegin() const {
+        return tree.cbegin();
+}
+ConstIterator cend() const {
+        return tree.cend();
+}
+std::size_t size() const {
+        return tree.size();
+}
+//the ordered side, for rank, select, bounds, ranges and scans
+const tree_type& ordered() const {
+        return tree;
+}
+//heap bytes held by the index on top of the tree nodes
+std::size_t index_bytes() const {
+        return slots.capacity() * sizeof(entry);
+}
+
+void insert(const key& k, const value& v);
+bool erase(const key& k);
+void balance();
+void clear();
+ConstIterator find(const key& k) const;
+Iterator find(const key& k);
+value& operator[](const key& k);
+const value& operator[](const key& k) const;
+template <class F>
+void for_each(F f) const {
+        tree.for_each(f);
+}
+};
+
+//returns the slot holding k, or slots.size() if k is not indexed
+template <class key, class value, class hash>
+std::size_t HashIndexedBST<key, value, hash>::locate(const key& k) const {
+        if (live == 0)
+                return slots.size();
+        std::uint64_t h = hash_of(k);
+        for (std::size_t i = home_of(h); ; i = (i + 1) & mask()) {
+                const entry& current = slots[i];
+                if (current.indexed == nullptr)
+                        return slots.size();
+                if (current.mixed == h && current.indexed->data_pair.first == k)
+                        return i;
+        }
+}
+
+//keeps the load factor at or below 3/4
+template <class key, class value, class hash>
+void HashIndexedBST<key, value, hash>::index_node(std::uint64_t h, node* n){
+        if ((live + 1) * 4 > slots.size() * 3)
+                rehash(std::max<std::size_t>(16, slots.size() * 2));
+        std::size_t i = home_of(h);
+        while (slots[i].indexed != nullptr)
+                i = (i + 1) & mask();
+        slots[i] = entry{h, n};
+        ++live;
+}
+
+//backward-shift deletion: later entries of the probe run move up, so lookups never need tombstones
+template <class key, class value, class hash>
+void HashIndexedBST<key, value, hash>::unindex_slot(std::size_t i){
+        for (std::size_t j = (i + 1) & mask(); slots[j].indexed != nullptr; j = (j + 1) & mask()) {
+                if (((j - home_of(slots[j].mixed)) & mask()) >= ((j - i) & mask())) {
+                        slots[i] = slots[j];
+                        i = j;
+                }
+        }
+        slots[i] = entry{0, nullptr};
+        --live;
+}
+
+template <class key, class value, class hash>
+void HashIndexedBST<key, value, hash>::rehash(std::size_t capacity){
+        std::vector<entry> old_slots(capacity, entry{0, nullptr});
+        old_slots.swap(slots);
+        shift = 64;
+        for (std::size_t c = 1; c < capacity; c *= 2)
+                --shift;
+        for (const auto& current : old_slots) {
+                if (current.indexed == nullptr)
+                        continue;
+                std::size_t i = home_of(current.mixed);
+                while (slots[i].indexed != nullptr)
+                        i = (i + 1) & mask();
+                slots[i] = current;
+        }
+}
+
+template <class key, class value, class hash>
+void HashIndexedBST<key, value, hash>::rebuild_index(){
+        std::size_t capacity = 16;
+        while (capacity * 3 < tree.size() * 4)
+                capacity *= 2;
+        reset_index();
+        rehash(capacity);
+        tree_type::for_each_node(tree.root_node.get(), [this](node* n) {
+                index_node(hash_of(n->data_pair.first), n);
+        });
+}
+
+//an existing key only gets its value replaced, which leaves its node and so its index entry in place
+template <class key, class value, class hash>
+void HashIndexedBST<key, value, hash>::insert(const key& k, const value& v){
+        std::size_t i = locate(k);
+        if (i != slots.size()) {
+                slots[i].indexed->data_pair.second = v;
+                return;
+        }
+        index_node(hash_of(k), tree.insert_node(k, v));
+}
+
+//erasing relinks the in-order successor but never moves it to another node, so only k's entry goes stale
+template <class key, class value, class hash>
+bool HashIndexedBST<key, value, hash>::erase(const key& k){
+        std::size_t i = locate(k);
+        if (i == slots.size())
+                return false;
+        unindex_slot(i);
+        tree.erase(k);
+        return true;
+}
+
+//balancing allocates fresh nodes, so the index is rebuilt in O(n)
+template <class key, class value, class hash>
+void HashIndexedBST<key, value, hash>::balance(){
+        if (size() == 0)
+                return;
+        tree.balance();
+        rebuild_index();
+}
+
+template <class key, class value, class hash>
+void HashIndexedBST<key, value, hash>::clear(){
+        tree.reset_nodes();
+        reset_index();
+}
+
+template <class key, class value, class hash>
+typename HashIndexedBST<key, value, hash>::ConstIterator HashIndexedBST<key, value, hash>::find(const key& k) const {
+        std::size_t i = locate(k);
+        return ConstIterator(i == slots.size() ? nullptr : slots[i].indexed);
+}
+
+template <class key, class value, class hash>
+typename HashIndexedBST<key, value, hash>::Iterator HashIndexedBST<key, value, hash>::find(const key& k){
+        std::size_t i = locate(k);
+        return Iterator(i == slots.size() ? nullptr : slots[i].indexed);
+}
+
+template <class key, class value, class hash>
+value& HashIndexedBST<key, value, hash>::operator[](const key& k){
+        std::size_t i = locate(k);
+        if (i != slots.size())
+                return slots[i].indexed->data_pair.second;
+        node* inserted = tree.insert_node(k, value{});
+        index_node(hash_of(k), inserted);
+        return inserted->data_pair.second;
+}
+
+template <class key, class value, class hash>
+const value& HashIndexedBST<key, value, hash>::operator[](const key& k) const {
+        std::size_t i = locate(k);
+        if (i != slots.size())
+                return slots[i].indexed->data_pair.second;
+        throw std::runtime_error("tried accessing not existing key in const HashIndexedBST");
+}
+
+//ordered map from strings, stored as a prefix-compressed trie: a shared prefix is stored and compared once, a lookup
+//touches every key byte at most once, and iteration visits the keys in std::string order
+template <class value>
+class RadixTree
+{
+private:
+struct node;
+
+//children are kept sorted by the first byte of their label, which is stored next to the pointer to save a dereference per probe
+struct edge {
+        unsigned char first_byte;
+        std::unique_ptr<node> target;
+};
+
+//every node but the root has a non-empty label; a node that holds no value has at least two children
+struct node {
+        std::string label;
+        std::vector<edge> children;
+        node* parent;
+        bool terminal;
+        value data;
+};
+
+std::unique_ptr<node> root;
+std::size_t count = 0;
+
+static edge* edge_of(node* n, unsigned char first_byte) {
+        auto found = std::lower_bound(n->children.begin(), n->children.end(), first_byte, [](const edge& e, unsigned char c) {
+                return e.first_byte < c;
+        });
+        return found != n->children.end() && found->first_byte == first_byte ? &*found : nullptr;
+}
+node* locate(std::string_view k) const;
+node* insert_node(std::string_view k);
+void merge_with_child(node* n);
+static std::unique_ptr<node> clone_recursive(const node* source, node* parent);
+
+public:
+class Iterator;
+class ConstIterator;
+
+RadixTree() = default;
+RadixTree(const RadixTree& rhs) : root{rhs.root ? clone_recursive(rhs.root.get(), nullptr) : nullptr}, count{rhs.count} {}
+RadixTree& operator=(const RadixTree& rhs) {
+        if (this != &rhs) {
+                root = rhs.root ? clone_recursive(rhs.root.get(), nullptr) : nullptr;
+                count = rhs.count;
+        }
+        return *this;
+}
+RadixTree(RadixTree&& rhs) : root{std::move(rhs.root)}, count{rhs.count} {
+        rhs.count = 0;
+}
+RadixTree& operator=(RadixTree&& rhs) {
+        if (this != &rhs) {
+                root = std::move(rhs.root);
+                count = rhs.count;
+                rhs.count = 0;
+        }
+        return *this;
+}
+
+Iterator begin();
+Iterator end() {
+        return Iterator{nullptr, std::string()};
+}
+ConstIterator cbegin() const;
+ConstIterator cend() const {
+        return ConstIterator{nullptr, std::string()};
+}
+ConstIterator begin() const {
+        return cbegin();
+}
+ConstIterator end() const {
+        return cend();
+}
+
+std::size_t size() const {
+        return count;
+}
+void insert(std::string_view k, const value& v) {
+        insert_node(k)->data = v;
+}
+bool erase(std::string_view k);
+void clear() {
+        root = nullptr;
+        count = 0;
+}
+//an iterator carries its key, so find copies k once; contains and operator[] do not
+ConstIterator find(std::string_view k) const {
+        node* found = locate(k);
+        return found ? ConstIterator{found, std::string(k)} : cend();
+}
+Iterator find(std::string_view k) {
+        node* found = locate(k);
+        return found ? Iterator{found, std::string(k)} : end();
+}
+bool contains(std::string_view k) const {
+        return locate(k) != nullptr;
+}
+value& operator[](std::string_view k) {
+        return insert_node(k)->data;
+}
+const value& operator[](std::string_view k) const;
+};
+
+//dereferences to a pair of references, as the full key only exists in the iterator
+template <class value>
+class RadixTree<value>::Iterator {
+protected:
+node* current_node;
+std::string current_key;
+friend class RadixTree<value>;
+
+void step();
+
+public:
+using iterator_category = std::forward_iterator_tag;
+using value_type = std::pair<const std::string, value>;
+using difference_type = std::ptrdiff_t;
+using reference = std::pair<const std::string&, value&>;
+struct pointer {
+        reference pair;
+        const reference* operator->() const {
+                return &pair;
+        }
+};
+
+Iterator(node* n = nullptr, std::string k = std::string()) : current_node{n}, current_key{std::move(k)} {}
+
+reference operator*() const {
+        return reference{current_key, current_node->data};
+}
+pointer operator->() const {
+        return pointer{**this};
+}
+
+//pre-order walk: a key sorts before every key it is a prefix of, and children are ordered by their first byte
+Iterator& operator++() {
+        do {
+                step();
+        } while (current_node != nullptr && !current_node->terminal);
+        return *this;
+}
+Iterator operator++(int){
+        Iterator it{*this};
+        ++(*this);
+        return it;
+}
+
+bool operator==(const Iterator& other) const {
+        return current_node == other.current_node;
+}
+bool operator!=(const Iterator& other) const {
+        return !(*this == other);
+}
+};
+
+template <class value>
+class RadixTree<value>::ConstIterator : public RadixTree<value>::Iterator {
+public:
+using parent = typename RadixTree<value>::Iterator;
+using parent::Iterator;
+using reference = std::pair<const std::string&, const value&>;
+struct pointer {
+        reference pair;
+        const reference* operator->() const {
+                return &pair;
+        }
+};
+
+ConstIterator(const parent& it) : parent{it} {}
+
+reference operator*() const {
+        return reference{this->current_key, this->current_node->data};
+}
+pointer operator->() const {
+        return pointer{**this};
+}
+
+ConstIterator& operator++() {
+        parent::operator++();
+        return *this;
+}
+ConstIterator operator++(int){
+        ConstIterator it{*this};
+        ++(*this);
+        return it;
+}
+};
+
+template <class value>
+void RadixTree<value>::Iterator::step(){
+        if (!current_node->children.empty()) {
+                current_node = current_node->children.front().target.get();
+                current_key += current_node->label;
+                return;
+        }
+        while (current_node->parent != nullptr) {
+                node* parent_node = current_node->parent;
+                current_key.resize(current_key.size() - current_node->label.size());
+                edge* next = edge_of(parent_node, current_node->label[0]) + 1;
+                if (next != parent_node->children.data() + parent_node->children.size()) {
+                        current_node = next->target.get();
+                        current_key += current_node->label;
+                        return;
+                }
+                current_node = parent_node;
+        }
+        current_node = nullptr;
+}
+
+template <class value>
+typename RadixTree<value>::Iterator RadixTree<value>::begin(){
+        Iterator it{root.get(), std::string()};
+        if (root != nullptr && !root->terminal)
+                ++it;
+        return it;
+}
+
+template <class value>
+typename RadixTree<value>::ConstIterator RadixTree<value>::cbegin() const {
+        Iterator it{root.get(), std::string()};
+        if (root != nullptr && !root->terminal)
+                ++it;
+        return it;
+}
+
+template <class value>
+typename RadixTree<value>::node* RadixTree<value>::locate(std::string_view k) const {
+        node* current = root.get();
+        std::size_t depth = 0;
+        while (current != nullptr) {
+                if (depth == k.size())
+                        return current->terminal ? current : nullptr;
+                edge* next = edge_of(current, k[depth]);
+                if (next == nullptr)
+                        return nullptr;
+                const std::string& label = next->target->label;
+                if (k.size() - depth < label.size() || k.compare(depth, label.size(), label) != 0)
+                        return nullptr;
+                depth += label.size();
+                current = next->target.get();
+        }
+        return nullptr;
+}
+
+//returns the node holding k, adding it with value{} if it was missing; an edge that diverges from k is split at the mismatch
+template <class value>
+typename RadixTree<value>::node* RadixTree<value>::insert_node(std::string_view k){
+        if (root == nullptr)
+                root.reset(new node{std::string(), {}, nullptr, false, value{}});
+        node* current = root.get();
+        std::size_t depth = 0;
+        while (depth != k.size()) {
+                unsigned char first_byte = k[depth];
+                edge* next = edge_of(current, first_byte);
+                if (next == nullptr) {
+                        std::unique_ptr<node> leaf (new node{std::string(k.substr(depth)), {}, current, true, value{}});
+                        node* inserted = leaf.get();
+                        auto position = std::lower_bound(current->children.begin(), current->children.end(), first_byte, [](const edge& e, unsigned char c) {
+                                return e.first_byte < c;
+                        });
+                        current->children.insert(position, edge{first_byte, std::move(leaf)});
+                        ++count;
+                        return inserted;
+                }
+
+                node* child = next->target.get();
+                std::size_t common = 0;
+                std::size_t limit = std::min(child->label.size(), k.size() - depth);
+                while (common < limit && child->label[common] == k[depth + common])
+                        ++common;
+                if (common < child->label.size()) {
+                        std::unique_ptr<node> middle (new node{child->label.substr(0, common), {}, current, false, value{}});
+                        child->label.erase(0, common);
+                        child->parent = middle.get();
+                        middle->children.push_back(edge{static_cast<unsigned char>(child->label[0]), std::move(next->target)});
+                        next->target = std::move(middle);
+                }
+                depth += common;
+                current = next->target.get();
+        }
+        if (!current->terminal) {
+                current->terminal = true;
+                current->data = value{};
+                ++count;
+        }
+        return current;
+}
+
+//erasing may leave a valueless node with one child, which is then merged into that child to keep the trie compressed
+template <class value>
+bool RadixTree<value>::erase(std::string_view k){
+        node* found = locate(k);
+        if (found == nullptr)
+                return false;
+        found->terminal = false;
+        found->data = value{};
+        --count;
+        if (found->parent != nullptr && found->children.empty()) {
+                node* parent_node = found->parent;
+                edge* slot = edge_of(parent_node, found->label[0]);
+                parent_node->children.erase(parent_node->children.begin() + (slot - parent_node->children.data()));
+                found = parent_node;
+        }
+        if (found->parent != nullptr && !found->terminal && found->children.size() == 1)
+                merge_with_child(found);
+        return true;
+}
+
+template <class value>
+void RadixTree<value>::merge_with_child(node* n){
+        std::unique_ptr<node> child = std::move(n->children.front().target);
+        child->label.insert(0, n->label);
+        child->parent = n->parent;
+        edge_of(n->parent, n->label[0])->target = std::move(child);
+}
+
+template <class value>
+std::unique_ptr<typename RadixTree<value>::node> RadixTree<value>::clone_recursive(const node* source, node* parent){
+        std::unique_ptr<node> elem (new node{source->label, {}, parent, source->terminal, source->data});
+        elem->children.reserve(source->children.size());
+        for (const auto& child : source->children)
+                elem->children.push_back(edge{child.first_byte, clone_recursive(child.target.get(), elem.get())});
+        return elem;
+}
+
+template <class value>
+const value& RadixTree<value>::operator[](std::string_view k) const {
+        node* found = locate(k);
+        if (found != nullptr)
+                return found->data;
+        throw std::runtime_error("tried accessing not existing key in const RadixTree");
+}
+
+//concurrent ordered map over P key-range shards, each a BST behind its own lock; a small sorted array of split points
+//routes every key, so writers to different shards never meet. A shard that grows past skew_factor times the average
+//triggers an online re-split, which joins all shards and splits them again at equal ranks
+template <class key, class value>
+class ShardedBST
+{
+private:
+using tree_type = BST<key, value>;
+
+struct alignas(64) shard {
+        tree_type tree;
+        mutable std::shared_mutex lock;
+        std::atomic<std::size_t> count{0};
+};
+
+std::unique_ptr<shard[]> shards;
+unsigned shard_count;
+double skew_factor;
+//held shared by every operation and exclusively while the split points change
+mutable std::shared_mutex router_lock;
+std::vector<key> split_points;
+
+std::size_t route(const key& k) const {
+        return std::upper_bound(split_points.begin(), split_points.end(), k) - split_points.begin();
+}
+bool skewed(std::size_t shard_size) const;
+void repartition(const std::vector<key>* sample);
+void resplit() {
+        repartition(nullptr);
+}
+
+public:
+explicit ShardedBST(unsigned partitions = 0, double skew = 2.0);
+ShardedBST(const ShardedBST&) = delete;
+ShardedBST& operator=(const ShardedBST&) = delete;
+
+void insert(const key& k, const value& v);
+bool erase(const key& k);
+std::optional<value> find(const key& k) const;
+bool contains(const key& k) const {
+        return find(k).has_value();
+}
+std::size_t size() const;
+unsigned partitions() const {
+        return shard_count;
+}
+std::vector<key> current_split_points() const {
+        std::shared_lock<std::shared_mutex> router_guard(router_lock);
+        return split_points;
+}
+std::vector<std::size_t> shard_sizes() const;
+//replaces the split points by quantiles of a sample of keys, moving the stored pairs accordingly
+void assign_split_points(std::vector<key> sample);
+//routes a range of pairs to the shards on several threads, then fills every shard in one pass under its lock;
+//an empty router is first set up from a sample of the range, an empty shard is bulk-built from its sorted pairs
+template <class RandomIt>
+void insert_bulk(RandomIt first, RandomIt last, unsigned threads = 0);
+//visits all pairs in key order, each shard under its read lock; f must not call back into this ShardedBST
+template <class F>
+void for_each(F f) const;
+};
+
+template <class key, class value>
+ShardedBST<key, value>::ShardedBST(unsigned partitions, double skew) : shard_count{partitions ? partitions : 4 * std::max(1u, std::thread::hardware_concurrency())}, skew_factor{skew} {
+        shards.reset(new shard[shard_count]);
+}
+
+//small shards never count as skewed, so a growing map does not re-split while it is tiny
+template <class key, class value>
+bool ShardedBST<key, value>::skewed(std::size_t shard_size) const {
+        return shard_count > 1 && shard_size >= 4096 && shard_size > skew_factor * (size() / shard_count + 1);
+}
+
+//caller holds router_lock exclusively; the split points become quantiles of the sorted sample, or of the stored keys
+//without one. Joining and splitting only relinks O(shard_count) search paths
+template <class key, class value>
+void ShardedBST<key, value>::repartition(const std::vector<key>* sample){
+        tree_type all;
+        all.take_over(std::move(shards[0].tree));
+        for (unsigned i = 1; i < shard_count; ++i)
+                all.take_over(tree_type::join(std::move(all), std::move(shards[i].tree)));
+        std::size_t total = sample ? sample->size() : all.size();
+        split_points.clear();
+        for (unsigned i = 1; i < shard_count; ++i) {
+                std::size_t quantile = i * total / shard_count;
+                split_points.push_back(total == 0 ? key{} : sample ? (*sample)[quantile] : all.select(quantile)->first);
+        }
+        for (unsigned i = shard_count - 1; i > 0; --i) {
+                std::pair<tree_type, tree_type> parts = all.split(split_points[i-1]);
+                shards[i].tree.take_over(std::move(parts.second));
+                all.take_over(std::move(parts.first));
+        }
+        shards[0].tree.take_over(std::move(all));
+        for (unsigned i = 0; i < shard_count; ++i)
+                shards[i].count = shards[i].tree.size();
+}
+
+template <class key, class value>
+void ShardedBST<key, value>::assign_split_points(std::vector<key> sample){
+        std::sort(sample.begin(), sample.end());
+        std::unique_lock<std::shared_mutex> router_guard(router_lock);
+        repartition(&sample);
+}
+
+template <class key, class value>
+void ShardedBST<key, value>::insert(const key& k, const value& v){
+        std::size_t shard_size;
+        {
+                std::shared_lock<std::shared_mutex> router_guard(router_lock);
+                shard& target = shards[route(k)];
+                std::unique_lock<std::shared_mutex> shard_guard(target.lock);
+                target.tree.insert(k, v);
+                shard_size = target.tree.size();
+                target.count.store(shard_size, std::memory_order_relaxed);
+        }
+        //checked every 1024 keys per shard, and once more under the exclusive lock
+        if (shard_size % 1024 == 0 && skewed(shard_size)) {
+                std::unique_lock<std::shared_mutex> router_guard(router_lock);
+                std::size_t largest = 0;
+                for (unsigned i = 0; i < shard_count; ++i)
+                        largest = std::max(largest, shards[i].tree.size());
+                if (skewed(largest))
+                        resplit();
+        }
+}
+
+template <class key, class value>
+bool ShardedBST<key, value>::erase(const key& k){
+        std::shared_lock<std::shared_mutex> router_guard(router_lock);
+        shard& target = shards[route(k)];
+        std::unique_lock<std::shared_mutex> shard_guard(target.lock);
+        bool erased = target.tree.erase(k);
+        target.count.store(target.tree.size(), std::memory_order_relaxed);
+        return erased;
+}
+
+template <class key, class value>
+std::optional<value> ShardedBST<key, value>::find(const key& k) const {
+        std::shared_lock<std::shared_mutex> router_guard(router_lock);
+        const shard& target = shards[route(k)];
+        std::shared_lock<std::shared_mutex> shard_guard(target.lock);
+        typename tree_type::ConstIterator found = target.tree.find(k);
+        if (found == target.tree.cend())
+                return std::nullopt;
+        return found->second;
+}
+
+template <class key, class value>
+std::size_t ShardedBST<key, value>::size() const {
+        std::size_t total = 0;
+        for (unsigned i = 0; i < shard_count; ++i)
+                total += shards[i].count.load(std::memory_order_relaxed);
+        return total;
+}
+
+template <class key, class value>
+std::vector<std::size_t> ShardedBST<key, value>::shard_sizes() const {
+        std::vector<std::size_t> sizes;
+        for (unsigned i = 0; i < shard_count; ++i)
+                sizes.push_back(shards[i].count.load(std::memory_order_relaxed));
+        return sizes;
+}
+
+template <class key, class value>
+template <class RandomIt>
+void ShardedBST<key, value>::insert_bulk(RandomIt first, RandomIt last, unsigned threads){
+        std::size_t count = last - first;
+        if (count == 0)
+                return;
+        if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+        if (size() == 0) {
+                std::vector<key> sample;
+                std::size_t stride = std::max<std::size_t>(1, count / (64 * shard_count));
+                for (std::size_t i = 0; i < count; i += stride)
+                        sample.push_back(first[i].first);
+                assign_split_points(std::move(sample));
+        }
+
+        std::shared_lock<std::shared_mutex> router_guard(router_lock);
+        //buckets[chunk][shard] keeps the input order inside every chunk, so the last of duplicate keys wins
+        unsigned chunks = threads;
+        std::vector<std::vector<std::vector<std::size_t> > > buckets(chunks, std::vector<std::vector<std::size_t> >(shard_count));
+        tree_type::run_tasks(chunks, threads, [&](std::size_t chunk) {
+                for (std::size_t i = chunk * count / chunks; i < (chunk + 1) * count / chunks; ++i)
+                        buckets[chunk][route(first[i].first)].push_back(i);
+        });
+        tree_type::run_tasks(shard_count, threads, [&](std::size_t s) {
+                shard& target = shards[s];
+                std::unique_lock<std::shared_mutex> shard_guard(target.lock);
+                if (target.tree.size() == 0) {
+                        std::vector<std::size_t> indices;
+                        for (unsigned chunk = 0; chunk < chunks; ++chunk)
+                                indices.insert(indices.end(), buckets[chunk][s].begin(), buckets[chunk][s].end());
+                        std::stable_sort(indices.begin(), indices.end(), [&first](std::size_t lhs, std::size_t rhs) {
+                                return first[lhs].first < first[rhs].first;
+                        });
+                        std::vector<std::pair<key, value> > sorted;
+                        sorted.reserve(indices.size());
+                        for (std::size_t i = 0; i < indices.size(); ++i) {
+                                if (i + 1 < indices.size() && !(first[indices[i]].first < first[indices[i+1]].first))
+                                        continue;
+                                sorted.emplace_back(first[indices[i]].first, first[indices[i]].second);
+                        }
+                        target.tree.assign_sorted(sorted.begin(), sorted.end());
+                }
+                else {
+                        for (unsigned chunk = 0; chunk < chunks; ++chunk)
+                                for (const auto i : buckets[chunk][s])
+                                        target.tree.insert(first[i].first, first[i].second);
+                }
+                target.count.store(target.tree.size(), std::memory_order_relaxed);
+        });
+        router_guard.unlock();
+
+        std::unique_lock<std::shared_mutex> resplit_guard(router_lock);
+        std::size_t largest = 0;
+        for (unsigned i = 0; i < shard_count; ++i)
+                largest = std::max(largest, shards[i].tree.size());
+        if (skewed(largest))
+                resplit();
+}
+
+template <class key, class value>
+template <class F>
+void ShardedBST<key, value>::for_each(F f) const {
+        std::shared_lock<std::shared_mutex> router_guard(router_lock);
+        for (unsigned i = 0; i < shard_count; ++i) {
+                std::shared_lock<std::shared_mutex> shard_guard(shards[i].lock);
+                shards[i].tree.for_each(f);
+        }
+}
+
+
+//batches applied by a CombiningBST and the requests they carried
+struct CombiningStats {
+        std::size_t batches;
+        std::size_t requests;
+        double average_batch() const {
+                return batches ? double(requests) / batches : 0;
+        }
+};
+
+//a BST shared by many writing threads through flat combining: a thread publishes its request in a slot and the thread
+//that gets the lock applies every published request, sorted, in one descent of the tree, so a contended lock changes
+//hands once per batch instead of once per request
+template <class key, class value>
+class CombiningBST
+{
+private:
+using tree_type = BST<key, value>;
+
+enum class request_kind : unsigned char { insert, subscript };
+//a slot goes free -> claimed -> pending by its thread, pending -> done by the combiner and done -> free by its thread again
+enum slot_state : unsigned { free_slot, claimed_slot, pending_slot, done_slot };
+struct alignas(64) slot {
+        std::atomic<unsigned> state{free_slot};
+        request_kind kind;
+        const key* k;
+        const value* v;
+        value result;
+};
+
+tree_type tree;
+mutable std::mutex lock;
+std::unique_ptr<slot[]> slots;
+unsigned slot_count;
+std::vector<slot*> batch;
+std::vector<std::pair<std::size_t, std::size_t> > runs;
+std::size_t batches = 0;
+std::size_t requests = 0;
+
+slot& publish(request_kind kind, const key& k, const value* v);
+value complete(slot& request);
+void combine();
+
+public:
+explicit CombiningBST(unsigned publication_slots = 0) : slot_count{publication_slots ? publication_slots : 4 * std::max(1u, std::thread::hardware_concurrency())} {
+        slots.reset(new slot[slot_count]);
+}
+CombiningBST(const CombiningBST&) = delete;
+CombiningBST& operator=(const CombiningBST&) = delete;
+
+void insert(const key& k, const value& v) {
+        complete(publish(request_kind::insert, k, &v));
+}
+//like BST::operator[] it adds a missing key with value{}, but returns a copy since the tree keeps changing
+value operator[](const key& k) {
+        return complete(publish(request_kind::subscript, k, nullptr));
+}
+std::optional<value> find(const key& k) const;
+bool contains(const key& k) const {
+        return find(k).has_value();
+}
+std::size_t size() const {
+        std::lock_guard<std::mutex> guard(lock);
+        return tree.size();
+}
+CombiningStats combining_stats() const {
+        std::lock_guard<std::mutex> guard(lock);
+        return CombiningStats{batches, requests};
+}
+//visits all pairs in key order under the lock; f must not call back into this CombiningBST
+template <class F>
+void for_each(F f) const {
+        std::lock_guard<std::mutex> guard(lock);
+        tree.for_each(f);
+}
+};
+
+//every thread starts looking for a free slot at its own one, so slots are only shared when threads outnumber them
+template <class key, class value>
+typename CombiningBST<key, value>::slot& CombiningBST<key, value>::publish(request_kind kind, const key& k, const value* v){
+        static std::atomic<unsigned> next_thread{0};
+        thread_local unsigned thread_index = next_thread.fetch_add(1, std::memory_order_relaxed);
+        for (unsigned attempt = 0; ; ++attempt) {
+                slot& request = slots[(thread_index + attempt) % slot_count];
+                unsigned expected = free_slot;
+                if (request.state.compare_exchange_strong(expected, claimed_slot, std::memory_order_acquire)) {
+                        request.kind = kind;
+                        request.k = &k;
+                        request.v = v;
+                        request.state.store(pending_slot, std::memory_order_release);
+                        return request;
+                }
+                if ((attempt + 1) % slot_count == 0)
+                        std::this_thread::yield();
+        }
+}
+
+//waits until some combiner served the request, becoming the combiner whenever the lock is free
+template <class key, class value>
+value CombiningBST<key, value>::complete(slot& request){
+        while (request.state.load(std::memory_order_acquire) != done_slot) {
+                if (lock.try_lock()) {
+                        combine();
+                        lock.unlock();
+                }
+                else
+                        std::this_thread::yield();
+        }
+        value result = request.kind == request_kind::subscript ? std::move(request.result) : value{};
+        request.state.store(free_slot, std::memory_order_release);
+        return result;
+}
+
+//caller holds the lock; requests on one key are applied in slot order
+template <class key, class value>
+void CombiningBST<key, value>::combine(){
+        batch.clear();
+        for (unsigned i = 0; i < slot_count; ++i) {
+                if (slots[i].state.load(std::memory_order_acquire) == pending_slot)
+                        batch.push_back(&slots[i]);
+        }
+        if (batch.empty())
+                return;
+        //a lone request, the common case without contention, skips sorting and the batch descent
+        if (batch.size() == 1 && batch[0]->kind == request_kind::insert)
+                tree.insert_node(*batch[0]->k, *batch[0]->v);
+        else {
+                std::stable_sort(batch.begin(), batch.end(), [](const slot* lhs, const slot* rhs) {
+                        return *lhs->k < *rhs->k;
+                });
+                runs.clear();
+                for (std::size_t i = 0; i < batch.size(); ++i) {
+                        if (i == 0 || *batch[i-1]->k < *batch[i]->k)
+                                runs.emplace_back(i, i);
+                        runs.back().second = i + 1;
+                }
+                tree.insert_batch(runs.begin(), runs.end(), [this](const std::pair<std::size_t, std::size_t>& run) -> const key& {
+                        return *batch[run.first]->k;
+                }, [this](const std::pair<std::size_t, std::size_t>& run, typename tree_type::node* n) {
+                        for (std::size_t i = run.first; i < run.second; ++i) {
+                                if (batch[i]->kind == request_kind::insert)
+                                        n->data_pair.second = *batch[i]->v;
+                                else
+                                        batch[i]->result = n->data_pair.second;
+                        }
+                });
+        }
+        ++batches;
+        requests += batch.size();
+        for (slot* served : batch)
+                served->state.store(done_slot, std::memory_order_release);
+}
+
+template <class key, class value>
+std::optional<value> CombiningBST<key, value>::find(const key& k) const {
+        std::lock_guard<std::mutex> guard(lock);
+        typename tree_type::ConstIterator found = tree.find(k);
+        if (found == tree.cend())
+                return std::nullopt;
+        return found->second;
+}
+
+
+//a BST shared by readers and writers behind a read-write lock, which it can rebalance without stopping them:
+//rebalance_async() copies the pairs in short read-locked chunks, builds the balanced tree on a background thread,
+//replays the writes that arrived meanwhile and swaps the new tree in under a brief write lock
+template <class key, class value>
+class ConcurrentBST
+{
+private:
+using tree_type = BST<key, value>;
+//a write to replay on the rebuilt tree, an empty value standing for an erase
+using logged_write = std::pair<key, std::optional<value> >;
+
+std::unique_ptr<tree_type> tree;
+mutable std::shared_mutex tree_lock;
+std::atomic<bool> logging{false};
+std::mutex log_lock;
+std::vector<logged_write> replay_log;
+//guards rebuild, which any thread may start, poll or wait for; waiters copy it and wait outside the lock
+mutable std::mutex rebuild_lock;
+std::shared_future<void> rebuild;
+std::size_t chunk_size;
+//under a steady write rate the log may never shrink below a chunk, so after this many rounds the rest is replayed under
+//the final write lock
+static constexpr unsigned max_replay_rounds = 8;
+
+//caller holds tree_lock exclusively
+void log_write(const key& k, std::optional<value> v) {
+        if (logging.load()) {
+                std::lock_guard<std::mutex> guard(log_lock);
+                replay_log.emplace_back(k, std::move(v));
+        }
+}
+void rebuild_balanced();
+
+public:
+//the rebuild copies chunk pairs per read lock, so a writer waits for at most one chunk
+explicit ConcurrentBST(std::size_t snapshot_chunk = 4096) : tree{new tree_type}, chunk_size{std::max<std::size_t>(1, snapshot_chunk)} {}
+ConcurrentBST(const ConcurrentBST&) = delete;
+ConcurrentBST& operator=(const ConcurrentBST&) = delete;
+//waits without rethrowing, since a destructor must not throw
+~ConcurrentBST() {
+        if (rebuild.valid())
+                rebuild.wait();
+}
+
+void insert(const key& k, const value& v) {
+        std::unique_lock<std::shared_mutex> guard(tree_lock);
+        tree->insert(k, v);
+        log_write(k, v);
+}
+bool erase(const key& k) {
+        std::unique_lock<std::shared_mutex> guard(tree_lock);
+        log_write(k, std::nullopt);
+        return tree->erase(k);
+}
+std::optional<value> find(const key& k) const;
+bool contains(const key& k) const {
+        return find(k).has_value();
+}
+std::size_t size() const {
+        std::shared_lock<std::shared_mutex> guard(tree_lock);
+        return tree->size();
+}
+//rebalances in place under the write lock, stalling readers and writers for the whole rebuild
+void balance() {
+        wait_rebalance();
+        std::unique_lock<std::shared_mutex> guard(tree_lock);
+        if (tree->size() > 0)
+                tree->balance();
+}
+//starts a background rebuild unless one is running, returning whether it did
+bool rebalance_async();
+bool rebalancing() const {
+        std::lock_guard<std::mutex> guard(rebuild_lock);
+        return rebuild.valid() && rebuild.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+}
+//waits for a running rebuild; what a rebuild threw is rethrown here until rebalance_async reports it once more
+void wait_rebalance() {
+        std::shared_future<void> running;
+        {
+                std::lock_guard<std::mutex> guard(rebuild_lock);
+                running = rebuild;
+        }
+        if (running.valid())
+                running.get();
+}
+//visits all pairs in key order under the read lock; f must not call back into this ConcurrentBST
+template <class F>
+void for_each(F f) const {
+        std::shared_lock<std::shared_mutex> guard(tree_lock);
+        tree->for_each(f);
+}
+};
+
+template <class key, class value>
+std::optional<value> ConcurrentBST<key, value>::find(const key& k) const {
+        std::shared_lock<std::shared_mutex> guard(tree_lock);
+        const tree_type& current = *tree;
+        typename tree_type::ConstIterator found = current.find(k);
+        if (found == current.cend())
+                return std::nullopt;
+        return found->second;
+}
+
+template <class key, class value>
+bool ConcurrentBST<key, value>::rebalance_async(){
+        std::lock_guard<std::mutex> guard(rebuild_lock);
+        if (rebuild.valid()) {
+                if (rebuild.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                        return false;
+                //a failed rebuild is reported once more here, and then forgotten
+                std::shared_future<void> finished = std::move(rebuild);
+                rebuild = std::shared_future<void>();
+                finished.get();
+        }
+        rebuild = std::async(std::launch::async, [this]() {
+                rebuild_balanced();
+        }).share();
+        return true;
+}
+
+//a chunk copied after a write to its keys sees that write and replays it too, which changes nothing since replaying
+//in log order ends with each key's last write; the old tree is freed after the swap, on this thread and outside the lock
+template <class key, class value>
+void ConcurrentBST<key, value>::rebuild_balanced(){
+        logging.store(true);
+        std::vector<std::pair<key, value> > pairs;
+        for (bool more = true; more; ) {
+                std::shared_lock<std::shared_mutex> guard(tree_lock);
+                const tree_type& current = *tree;
+                typename tree_type::ConstIterator it = pairs.empty() ? current.cbegin() : current.upper_bound(pairs.back().first);
+                for (std::size_t copied = 0; copied < chunk_size && it != current.cend(); ++copied, ++it)
+                        pairs.emplace_back(it->first, it->second);
+                more = it != current.cend();
+        }
+        std::unique_ptr<tree_type> balanced{new tree_type};
+        balanced->assign_sorted(pairs.begin(), pairs.end());
+        pairs = std::vector<std::pair<key, value> >();
+
+        auto replay = [&balanced](std::vector<logged_write>& writes) {
+                for (logged_write& write : writes) {
+                        if (write.second)
+                                balanced->insert(write.first, *write.second);
+                        else
+                                balanced->erase(write.first);
+                }
+                writes.clear();
+        };
+        //replays in rounds until few enough writes are left to replay under the write lock, or the rounds run out
+        std::vector<logged_write> writes;
+        std::size_t replayed;
+        unsigned rounds = 0;
+        do {
+                {
+                        std::lock_guard<std::mutex> guard(log_lock);
+                        writes.swap(replay_log);
+                }
+                replayed = writes.size();
+                replay(writes);
+        } while (replayed > chunk_size && ++rounds < max_replay_rounds);
+        {
+                std::unique_lock<std::shared_mutex> guard(tree_lock);
+                {
+                        std::lock_guard<std::mutex> log_guard(log_lock);
+                        writes.swap(replay_log);
+                        logging.store(false);
+                }
+                replay(writes);
+                tree.swap(balanced);
+        }
+}
+
+//an entry of a StaticMap; a plain aggregate rather than std::pair, whose assignment is not constexpr before C++20
+template <class key, class value>
+struct StaticMapEntry {
+        key first;
+        value second;
+};
+
+//an immutable ordered map over a fixed table, built entirely at compile time: the entries are sorted and stored in
+//breadth-first (Eytzinger) order, the layout the search walks, so a constexpr instance needs neither heap nor startup
+//code and a find on a constant key folds to its result. The search is branch-free and runs at most log2(N) + 1 rounds,
+//which the compiler can unroll since N is a constant. Key and value must be literal types that are default constructible
+template <class key, class value, std::size_t N>
+class StaticMap
+{
+static_assert(N > 0, "a StaticMap needs at least one entry");
+private:
+StaticMapEntry<key, value> slots[N] = {};
+
+//in-order position i of the Eytzinger tree rooted at slot gets the i-th sorted entry
+constexpr void fill(const StaticMapEntry<key, value> (&sorted)[N], std::size_t& position, std::size_t slot) {
+        if (slot >= N)
+                return;
+        fill(sorted, position, 2*slot + 1);
+        slots[slot] = sorted[position++];
+        fill(sorted, position, 2*slot + 2);
+}
+
+public:
+class ConstIterator;
+
+constexpr explicit StaticMap(const StaticMapEntry<key, value> (&entries)[N]);
+
+constexpr ConstIterator find(const key& k) const;
+constexpr bool contains(const key& k) const;
+constexpr const value& operator[](const key& k) const;
+constexpr std::size_t size() const {
+        return N;
+}
+
+constexpr ConstIterator cbegin() const;
+constexpr ConstIterator cend() const;
+constexpr ConstIterator begin() const {
+        return cbegin();
+}
+constexpr ConstIterator end() const {
+        return cend();
+}
+};
+
+//walks the implicit tree in key order; slot N is the end
+template <class key, class value, std::size_t N>
+class StaticMap<key, value, N>::ConstIterator {
+const StaticMap* map;
+std::size_t slot;
+friend class StaticMap<key, value, N>;
+
+constexpr ConstIterator(const StaticMap* m, std::size_t s) : map{m}, slot{s} {}
+
+public:
+using iterator_category = std::forward_iterator_tag;
+using value_type = StaticMapEntry<key, value>;
+using difference_type = std::ptrdiff_t;
+using pointer = const value_type*;
+using reference = const value_type&;
+
+constexpr ConstIterator() : map{nullptr}, slot{N} {}
+
+constexpr reference operator*() const {
+        return map->slots[slot];
+}
+constexpr pointer operator->() const {
+        return &map->slots[slot];
+}
+
+constexpr ConstIterator& operator++() {
+        if (2*slot + 2 < N) {
+                slot = 2*slot + 2;
+                while (2*slot + 1 < N)
+                        slot = 2*slot + 1;
+                return *this;
+        }
+        while (slot != 0 && slot % 2 == 0)
+                slot = (slot - 1) / 2;
+        slot = slot == 0 ? N : (slot - 1) / 2;
+        return *this;
+}
+constexpr ConstIterator operator++(int){
+        ConstIterator it{*this};
+        ++(*this);
+        return it;
+}
+
+constexpr bool operator==(const ConstIterator& other) const {
+        return slot == other.slot;
+}
+constexpr bool operator!=(const ConstIterator& other) const {
+        return !(*this == other);
+}
+};
+
+//sorts a copy of the entries by insertion, which is constexpr and cheap for the table sizes this is meant for;
+//a duplicate key throws, which stops the compilation of a constexpr map
+template <class key, class value, std::size_t N>
+constexpr StaticMap<key, value, N>::StaticMap(const StaticMapEntry<key, value> (&entries)[N]){
+        StaticMapEntry<key, value> sorted[N] = {};
+        for (std::size_t i = 0; i < N; ++i) {
+                std::size_t j = i;
+                for (; j > 0 && entries[i].first < sorted[j-1].first; --j)
+                        sorted[j] = sorted[j-1];
+                if (j > 0 && !(sorted[j-1].first < entries[i].first))
+                        throw std::runtime_error("duplicate key in StaticMap");
+                sorted[j] = entries[i];
+        }
+        std::size_t position = 0;
+        fill(sorted, position, 0);
+}
+
+template <class key, class value, std::size_t N>
+constexpr typename StaticMap<key, value, N>::ConstIterator StaticMap<key, value, N>::find(const key& k) const {
+        //a branch-free descent to the lower bound, counting slots from 1: each round appends one bit, going right on 1;
+        //dropping the trailing 1 bits and one 0 bit afterwards climbs back to the last left turn, the smallest key >= k
+        std::size_t position = 1;
+        while (position <= N)
+                position = 2*position + (slots[position-1].first < k);
+        while (position & 1)
+                position >>= 1;
+        position >>= 1;
+        if (position == 0 || !(slots[position-1].first == k))
+                return cend();
+        return ConstIterator(this, position - 1);
+}
+
+template <class key, class value, std::size_t N>
+constexpr bool StaticMap<key, value, N>::contains(const key& k) const {
+        return find(k) != cend();
+}
+
+template <class key, class value, std::size_t N>
+constexpr const value& StaticMap<key, value, N>::operator[](const key& k) const {
+        ConstIterator found = find(k);
+        if (found == cend())
+                throw std::runtime_error("key not found in StaticMap");
+        return found->second;
+}
+
+template <class key, class value, std::size_t N>
+constexpr typename StaticMap<key, value, N>::ConstIterator StaticMap<key, value, N>::cbegin() const {
+        std::size_t slot = 0;
+        while (2*slot + 1 < N)
+                slot = 2*slot + 1;
+        return ConstIterator(this, slot);
+}
+
+template <class key, class value, std::size_t N>
+constexpr typename StaticMap<key, value, N>::ConstIterator StaticMap<key, value, N>::cend() const {
+        return ConstIterator(this, N);
+}
+
+//deduces the size from a braced table: constexpr auto handlers = make_static_map<int, Handler>({{1, f}, {2, g}});
+template <class key, class value, std::size_t N>
+constexpr StaticMap<key, value, N> make_static_map(const StaticMapEntry<key, value> (&entries)[N]){
+        return StaticMap<key, value, N>(entries);
 }
 
 #endif
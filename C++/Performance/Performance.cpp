@@ -1,10 +1,53 @@
 #include "BST_performance.h"
 #include <map>
+#include <mutex>
+#include <memory_resource>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
 #include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <malloc.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
 
-int main(){
+std::mt19937 random_engine;
+
+//counts heap allocations and their bytes so that benchmarks can report allocations per visited element and memory per key,
+//live_bytes follows the usable size of the blocks still allocated, so it also covers memory given back while building;
+//kept out of line so that the compiler does not pair inlined new/delete expressions with malloc/free
+std::atomic<std::size_t> allocation_count{0};
+std::atomic<std::size_t> allocated_bytes{0};
+std::atomic<std::size_t> live_bytes{0};
+
+__attribute__((noinline)) void* operator new(std::size_t size){
+        ++allocation_count;
+        allocated_bytes += size;
+        if (void* p = std::malloc(size ? size : 1)) {
+                live_bytes += malloc_usable_size(p);
+                return p;
+        }
+        throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+        live_bytes -= malloc_usable_size(p);
+        std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept {
+        live_bytes -= malloc_usable_size(p);
+        std::free(p);
+}
+
+void lookup_times_benchmark(){
         std::vector<std::vector<double> > lookup_times;
         int nodes=10000;
         int nodes_max=10000001;
@@ -22,10 +65,10 @@ int main(){
                         keys.push_back(i);
 
                 std::vector<int> input_keys = keys;
-                std::random_shuffle (input_keys.begin(), input_keys.end());
+                std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
 
                 std::vector<int> find_keys = keys;
-                std::random_shuffle (find_keys.begin(), find_keys.end());
+                std::shuffle (find_keys.begin(), find_keys.end(), random_engine);
 
 
                 //Execute map
@@ -87,3 +130,1159 @@ int main(){
         }
         results.close();
 }
+
+//full in-order scans of a balanced tree, reported in nodes per second
+void iteration_benchmark(int nodes){
+        std::map<int, int> map;
+        BST<int, int> bst;
+
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        for (auto elem : input_keys) {
+                map.insert({elem, elem});
+                bst.insert(elem, elem);
+        }
+        bst.balance();
+
+        long long checksum = 0;
+        auto start_time = std::chrono::high_resolution_clock::now();
+        for (const auto& data_pair : map)
+                checksum += data_pair.second;
+        auto end_time = std::chrono::high_resolution_clock::now();
+        double map_seconds = std::chrono::duration<double>(end_time-start_time).count();
+
+        start_time = std::chrono::high_resolution_clock::now();
+        for (auto it = bst.begin(); it != bst.end(); ++it)
+                checksum += (*it).second;
+        end_time = std::chrono::high_resolution_clock::now();
+        double iterator_seconds = std::chrono::duration<double>(end_time-start_time).count();
+
+        start_time = std::chrono::high_resolution_clock::now();
+        bst.for_each([&checksum](const std::pair<const int, int>& data_pair) {
+                checksum += data_pair.second;
+        });
+        end_time = std::chrono::high_resolution_clock::now();
+        double for_each_seconds = std::chrono::duration<double>(end_time-start_time).count();
+
+        std::cout << "Iteration throughput for " << nodes << " nodes in: nodes per second (checksum " << checksum << ")" << std::endl;
+        std::cout << "map" << " " << "BST(Iterator)" << " " << "BST(for_each)" << std::endl;
+        std::cout << nodes/map_seconds << " " << nodes/iterator_seconds << " " << nodes/for_each_seconds << std::endl;
+}
+
+//parallel_reduce over a balanced tree for 1, 2, 4, ... threads up to the number of hardware threads
+void parallel_benchmark(int nodes){
+        BST<int, long long> bst;
+
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        for (auto elem : input_keys)
+                bst.insert(elem, elem);
+        bst.balance();
+
+        unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<unsigned> thread_counts;
+        for (unsigned threads = 1; threads < max_threads; threads *= 2)
+                thread_counts.push_back(threads);
+        thread_counts.push_back(max_threads);
+
+        std::cout << "parallel_reduce over " << nodes << " nodes in: milliseconds" << std::endl;
+        std::cout << "threads" << " " << "time" << " " << "speedup" << std::endl;
+        double single_thread_time = 0;
+        for (auto threads : thread_counts) {
+                auto start_time = std::chrono::high_resolution_clock::now();
+                long long sum = bst.parallel_reduce(0LL, [](long long lhs, long long rhs) {
+                        return lhs + rhs;
+                }, threads);
+                auto end_time = std::chrono::high_resolution_clock::now();
+                double time = std::chrono::duration<double, std::milli>(end_time-start_time).count();
+                if (threads == 1)
+                        single_thread_time = time;
+                std::cout << threads << " " << time << " " << single_thread_time/time << (sum == (long long)nodes*(nodes-1)/2 ? "" : " (wrong sum)") << std::endl;
+        }
+}
+
+//cold start by insert versus warm start from a snapshot file
+void snapshot_benchmark(int nodes){
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+
+        auto start_time = std::chrono::high_resolution_clock::now();
+        BST<int, int> bst;
+        for (auto elem : input_keys)
+                bst.insert(elem, elem);
+        auto end_time = std::chrono::high_resolution_clock::now();
+        double insert_time = std::chrono::duration<double, std::milli>(end_time-start_time).count();
+
+        start_time = std::chrono::high_resolution_clock::now();
+        bst.save("snapshot_benchmark.bin");
+        end_time = std::chrono::high_resolution_clock::now();
+        double save_time = std::chrono::duration<double, std::milli>(end_time-start_time).count();
+
+        start_time = std::chrono::high_resolution_clock::now();
+        BST<int, int> loaded_bst;
+        loaded_bst.load("snapshot_benchmark.bin");
+        end_time = std::chrono::high_resolution_clock::now();
+        double load_time = std::chrono::duration<double, std::milli>(end_time-start_time).count();
+
+        start_time = std::chrono::high_resolution_clock::now();
+        BSTSnapshot<int, int> view("snapshot_benchmark.bin", false);
+        end_time = std::chrono::high_resolution_clock::now();
+        double map_time = std::chrono::duration<double, std::milli>(end_time-start_time).count();
+
+        long long checksum = 0;
+        start_time = std::chrono::high_resolution_clock::now();
+        for (const auto elem : input_keys)
+                checksum += view.find(elem)->second;
+        end_time = std::chrono::high_resolution_clock::now();
+        double view_lookup_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time-start_time).count()/double(nodes);
+        std::remove("snapshot_benchmark.bin");
+
+        std::cout << "Snapshot of " << nodes << " nodes in: milliseconds, view lookups in: nanoseconds (checksum " << checksum << ")" << std::endl;
+        std::cout << "insert" << " " << "save" << " " << "load" << " " << "map(view)" << " " << "lookup(view)" << std::endl;
+        std::cout << insert_time << " " << save_time << " " << load_time << " " << map_time << " " << view_lookup_time << std::endl;
+}
+
+//parse-plus-build throughput of BST::load_text against reading with iostreams and inserting line by line
+void text_load_benchmark(int nodes){
+        std::vector<int> keys;
+        for (auto i=0; i < nodes; ++i)
+                keys.push_back(i);
+        std::vector<int> shuffled_keys = keys;
+        std::shuffle (shuffled_keys.begin(), shuffled_keys.end(), random_engine);
+
+        std::cout << "Text loading of " << nodes << " lines in: MB per second" << std::endl;
+        std::cout << "input" << " " << "iostream+insert" << " " << "load_text" << std::endl;
+        for (const auto& input : {std::make_pair(std::string("sorted"), &keys), std::make_pair(std::string("shuffled"), &shuffled_keys)}) {
+                {
+                        std::ofstream text_file("text_benchmark.txt");
+                        for (auto elem : *input.second)
+                                text_file << elem << "," << elem*3 << "\n";
+                }
+                std::ifstream size_probe("text_benchmark.txt", std::ios::binary | std::ios::ate);
+                double megabytes = size_probe.tellg()/1e6;
+
+                //inserting sorted keys one by one degenerates the BST into a list, so the baseline only runs on shuffled input
+                double insert_seconds = 0;
+                if (input.first == "shuffled") {
+                        auto start_time = std::chrono::high_resolution_clock::now();
+                        BST<int, int> inserted_bst;
+                        std::ifstream text_file("text_benchmark.txt");
+                        int k, v;
+                        char separator;
+                        while (text_file >> k >> separator >> v)
+                                inserted_bst.insert(k, v);
+                        auto end_time = std::chrono::high_resolution_clock::now();
+                        insert_seconds = std::chrono::duration<double>(end_time-start_time).count();
+                }
+
+                auto start_time = std::chrono::high_resolution_clock::now();
+                BST<int, int> loaded_bst;
+                loaded_bst.load_text("text_benchmark.txt");
+                auto end_time = std::chrono::high_resolution_clock::now();
+                double load_seconds = std::chrono::duration<double>(end_time-start_time).count();
+
+                std::cout << input.first << " " << (insert_seconds > 0 ? std::to_string(megabytes/insert_seconds) : "-") << " " << megabytes/load_seconds << std::endl;
+        }
+        std::remove("text_benchmark.txt");
+}
+
+//const full scans over std::string values: reference-returning ConstIterator against copying every pair
+void const_scan_benchmark(int nodes){
+        BST<int, std::string> bst;
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        for (auto elem : input_keys)
+                bst.insert(elem, "value string long enough to need the heap " + std::to_string(elem));
+        bst.balance();
+        const BST<int, std::string>& const_bst = bst;
+
+        std::cout << "Const scan over " << nodes << " std::string values in: allocations per element, nanoseconds per element" << std::endl;
+        std::cout << "scan" << " " << "allocations" << " " << "time" << std::endl;
+
+        std::size_t length = 0;
+        std::size_t allocations_before = allocation_count;
+        auto start_time = std::chrono::high_resolution_clock::now();
+        for (auto it = const_bst.cbegin(); it != const_bst.cend(); ++it) {
+                std::pair<const int, std::string> data_pair = *it;
+                length += data_pair.second.size();
+        }
+        auto end_time = std::chrono::high_resolution_clock::now();
+        std::cout << "copying" << " " << double(allocation_count - allocations_before)/nodes << " "
+                  << std::chrono::duration_cast<std::chrono::nanoseconds>(end_time-start_time).count()/double(nodes) << std::endl;
+
+        allocations_before = allocation_count;
+        start_time = std::chrono::high_resolution_clock::now();
+        for (const auto& data_pair : const_bst)
+                length += data_pair.second.size();
+        end_time = std::chrono::high_resolution_clock::now();
+        std::cout << "ConstIterator" << " " << double(allocation_count - allocations_before)/nodes << " "
+                  << std::chrono::duration_cast<std::chrono::nanoseconds>(end_time-start_time).count()/double(nodes) << std::endl;
+        std::cout << "(total length " << length << ")" << std::endl;
+}
+
+//lookups of std::string keys from const char*: a temporary std::string key against heterogeneous find
+void string_lookup_benchmark(int nodes){
+        std::vector<std::string> keys;
+        for (auto i=0; i < nodes; ++i)
+                keys.push_back("/srv/data/customers/region/" + std::to_string(i));
+        std::vector<std::string> input_keys = keys;
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        BST<std::string, int> bst;
+        for (const auto& elem : input_keys)
+                bst.insert(elem, 0);
+        bst.balance();
+
+        std::vector<const char*> queries;
+        for (const auto& elem : keys)
+                queries.push_back(elem.c_str());
+        std::shuffle (queries.begin(), queries.end(), random_engine);
+
+        std::cout << "String key lookups on " << nodes << " nodes in: allocations per lookup, nanoseconds per lookup" << std::endl;
+        std::cout << "lookup" << " " << "allocations" << " " << "time" << std::endl;
+
+        std::size_t found = 0;
+        std::size_t allocations_before = allocation_count;
+        auto start_time = std::chrono::high_resolution_clock::now();
+        for (const auto query : queries)
+                found += bst.find(std::string(query)) != bst.cend();
+        auto end_time = std::chrono::high_resolution_clock::now();
+        std::cout << "std::string(query)" << " " << double(allocation_count - allocations_before)/nodes << " "
+                  << std::chrono::duration_cast<std::chrono::nanoseconds>(end_time-start_time).count()/double(nodes) << std::endl;
+
+        allocations_before = allocation_count;
+        start_time = std::chrono::high_resolution_clock::now();
+        for (const auto query : queries)
+                found += bst.find(query) != bst.cend();
+        end_time = std::chrono::high_resolution_clock::now();
+        std::cout << "const char*" << " " << double(allocation_count - allocations_before)/nodes << " "
+                  << std::chrono::duration_cast<std::chrono::nanoseconds>(end_time-start_time).count()/double(nodes) << std::endl;
+        std::cout << "(found " << found << ")" << std::endl;
+}
+
+//draws keys 0..nodes-1 with Zipfian popularity, the hottest ranks assigned to randomly chosen keys
+std::vector<int> zipf_queries(int nodes, int queries, double exponent){
+        std::vector<double> cumulative(nodes);
+        double total = 0;
+        for (auto i=0; i < nodes; ++i) {
+                total += 1.0/std::pow(i+1, exponent);
+                cumulative[i] = total;
+        }
+        std::vector<int> key_of_rank(nodes);
+        for (auto i=0; i < nodes; ++i)
+                key_of_rank[i] = i;
+        std::shuffle (key_of_rank.begin(), key_of_rank.end(), random_engine);
+
+        std::uniform_real_distribution<double> uniform(0, total);
+        std::vector<int> result;
+        result.reserve(queries);
+        for (auto i=0; i < queries; ++i) {
+                std::size_t rank = std::upper_bound(cumulative.begin(), cumulative.end(), uniform(random_engine)) - cumulative.begin();
+                result.push_back(key_of_rank[std::min<std::size_t>(rank, nodes-1)]);
+        }
+        return result;
+}
+
+template <class Lookup>
+double average_lookup_time(const std::vector<int>& queries, Lookup lookup){
+        auto start_time = std::chrono::high_resolution_clock::now();
+        for (const auto elem : queries)
+                lookup(elem);
+        auto end_time = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end_time-start_time).count()/double(queries.size());
+}
+
+//skewed lookups: std::map, the balanced BST and the BST in the different splay modes
+void zipf_benchmark(int nodes, double exponent){
+        std::map<int, int> map;
+        BST<int, int> balanced_BST;
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        for (auto elem : input_keys) {
+                map.insert({elem, elem});
+                balanced_BST.insert(elem, elem);
+        }
+        balanced_BST.balance();
+        std::vector<int> queries = zipf_queries(nodes, nodes, exponent);
+
+        long long checksum = 0;
+        std::cout << "Zipfian lookups (exponent " << exponent << ") on " << nodes << " nodes in: nanoseconds" << std::endl;
+        std::cout << "map" << " " << "BST(balanced)" << " " << "BST(splay)" << " " << "BST(semi-splay)" << " " << "BST(splay every 8th)" << std::endl;
+        std::cout << average_lookup_time(queries, [&map, &checksum](int k) {
+                checksum += map.find(k)->second;
+        }) << " ";
+        std::cout << average_lookup_time(queries, [&balanced_BST, &checksum](int k) {
+                checksum += balanced_BST.find(k)->second;
+        }) << " ";
+        for (auto setting : {std::make_pair(SplayMode::full, 1u), std::make_pair(SplayMode::semi, 1u), std::make_pair(SplayMode::full, 8u)}) {
+                BST<int, int> splay_BST = balanced_BST;
+                splay_BST.set_splay_mode(setting.first, setting.second);
+                std::cout << average_lookup_time(queries, [&splay_BST, &checksum](int k) {
+                        checksum += splay_BST.find(k)->second;
+                }) << " ";
+        }
+        std::cout << std::endl << "(checksum " << checksum << ")" << std::endl;
+}
+
+//access-weighted rebuild: sampled hit counts from a Zipfian training trace, evaluated on a second trace of the same distribution
+void weighted_benchmark(int nodes, double exponent){
+        BST<int, int> balanced_BST;
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        for (auto elem : input_keys)
+                balanced_BST.insert(elem, elem);
+        balanced_BST.balance();
+
+        std::vector<int> queries = zipf_queries(nodes, 2*nodes, exponent);
+        std::vector<int> training_queries(queries.begin(), queries.begin() + nodes);
+        std::vector<int> test_queries(queries.begin() + nodes, queries.end());
+
+        balanced_BST.set_access_sampling(4);
+        for (const auto elem : training_queries)
+                balanced_BST.find(elem);
+        balanced_BST.set_access_sampling(0);
+        BST<int, int> weighted_BST = balanced_BST;
+        weighted_BST.balance_weighted();
+
+        //expected path lengths are evaluated on the test trace, counted with sampling on every find
+        BST<int, int> balanced_probe = balanced_BST;
+        BST<int, int> weighted_probe = weighted_BST;
+        balanced_probe.reset_access_counts();
+        weighted_probe.reset_access_counts();
+        balanced_probe.set_access_sampling(1);
+        weighted_probe.set_access_sampling(1);
+        for (const auto elem : test_queries) {
+                balanced_probe.find(elem);
+                weighted_probe.find(elem);
+        }
+
+        long long checksum = 0;
+        double balanced_time = average_lookup_time(test_queries, [&balanced_BST, &checksum](int k) {
+                checksum += balanced_BST.find(k)->second;
+        });
+        double weighted_time = average_lookup_time(test_queries, [&weighted_BST, &checksum](int k) {
+                checksum += weighted_BST.find(k)->second;
+        });
+
+        std::cout << "Access-weighted rebuild (Zipfian exponent " << exponent << ") on " << nodes << " nodes, log2(n) = " << std::log2(nodes) << " (checksum " << checksum << ")" << std::endl;
+        std::cout << "tree" << " " << "expected path length" << " " << "lookup time in nanoseconds" << std::endl;
+        std::cout << "BST(balanced)" << " " << balanced_probe.weighted_path_length() << " " << balanced_time << std::endl;
+        std::cout << "BST(weighted)" << " " << weighted_probe.weighted_path_length() << " " << weighted_time << std::endl;
+}
+
+//Zipfian lookups through BST::find with and without the hot-key lookup cache
+void cache_benchmark(int nodes, double exponent){
+        BST<int, int> bst;
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        for (auto elem : input_keys)
+                bst.insert(elem, elem);
+        bst.balance();
+        std::vector<int> queries = zipf_queries(nodes, nodes, exponent);
+
+        long long checksum = 0;
+        std::cout << "Zipfian lookups (exponent " << exponent << ") on " << nodes << " nodes in: nanoseconds" << std::endl;
+        std::cout << "cache slots" << " " << "hit rate" << " " << "time" << std::endl;
+        for (std::size_t slots : {0, 1024, 16384, 262144}) {
+                bst.set_lookup_cache(slots);
+                double time = average_lookup_time(queries, [&bst, &checksum](int k) {
+                        checksum += bst.find(k)->second;
+                });
+                std::cout << slots << " " << bst.lookup_cache_stats().hit_rate() << " " << time << std::endl;
+        }
+        std::cout << "(checksum " << checksum << ")" << std::endl;
+}
+
+//exact-match lookups in random order: the balanced BST, std::map, std::unordered_map and the BST with a hash index;
+//bytes per key are the heap bytes of the build, for HashIndexedBST the tree nodes plus the index
+void hash_index_benchmark(int nodes){
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        std::vector<int> queries = input_keys;
+        std::shuffle (queries.begin(), queries.end(), random_engine);
+
+        std::size_t bytes_before = allocated_bytes;
+        std::map<int, int> map;
+        for (auto elem : input_keys)
+                map.insert({elem, elem});
+        double map_bytes = double(allocated_bytes - bytes_before)/nodes;
+
+        bytes_before = allocated_bytes;
+        std::unordered_map<int, int> unordered_map;
+        unordered_map.reserve(nodes);
+        for (auto elem : input_keys)
+                unordered_map.insert({elem, elem});
+        double unordered_map_bytes = double(allocated_bytes - bytes_before)/nodes;
+
+        bytes_before = allocated_bytes;
+        BST<int, int> balanced_BST;
+        for (auto elem : input_keys)
+                balanced_BST.insert(elem, elem);
+        double BST_bytes = double(allocated_bytes - bytes_before)/nodes;
+        balanced_BST.balance();
+
+        HashIndexedBST<int, int> indexed_BST;
+        for (auto elem : input_keys)
+                indexed_BST.insert(elem, elem);
+        indexed_BST.balance();
+        double index_bytes = double(indexed_BST.index_bytes())/nodes;
+
+        long long checksum = 0;
+        std::cout << "Exact-match lookups on " << nodes << " nodes" << std::endl;
+        std::cout << "structure" << " " << "bytes per key" << " " << "lookup time in nanoseconds" << std::endl;
+        std::cout << "BST(balanced)" << " " << BST_bytes << " " << average_lookup_time(queries, [&balanced_BST, &checksum](int k) {
+                checksum += balanced_BST.find(k)->second;
+        }) << std::endl;
+        std::cout << "map" << " " << map_bytes << " " << average_lookup_time(queries, [&map, &checksum](int k) {
+                checksum += map.find(k)->second;
+        }) << std::endl;
+        std::cout << "unordered_map" << " " << unordered_map_bytes << " " << average_lookup_time(queries, [&unordered_map, &checksum](int k) {
+                checksum += unordered_map.find(k)->second;
+        }) << std::endl;
+        std::cout << "HashIndexedBST" << " " << BST_bytes + index_bytes << " (index " << index_bytes << ") " << average_lookup_time(queries, [&indexed_BST, &checksum](int k) {
+                checksum += indexed_BST.find(k)->second;
+        }) << std::endl;
+        std::cout << "(checksum " << checksum << ")" << std::endl;
+}
+
+//membership tests on a balanced BST of the even keys with and without a 1% Bloom filter, for growing shares of hits
+void bloom_benchmark(int nodes){
+        BST<int, int> balanced_BST;
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(2*i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        for (auto elem : input_keys)
+                balanced_BST.insert(elem, elem);
+        balanced_BST.balance();
+        //both trees are fresh copies, so that their nodes are laid out alike
+        BST<int, int> plain_BST = balanced_BST;
+        BST<int, int> filtered_BST = balanced_BST;
+        filtered_BST.set_bloom_filter(0.01);
+
+        long long checksum = 0;
+        std::cout << "Lookups on " << nodes << " nodes, Bloom filter of " << double(filtered_BST.bloom_filter_bytes())/nodes << " bytes per key, in: nanoseconds" << std::endl;
+        std::cout << "hit ratio" << " " << "BST" << " " << "BST(Bloom filter)" << " " << "observed false positive rate" << std::endl;
+        std::uniform_int_distribution<int> key_distribution(0, nodes-1);
+        for (double hit_ratio : {0.0, 0.2, 0.5, 0.8, 1.0}) {
+                std::bernoulli_distribution hit(hit_ratio);
+                std::vector<int> queries;
+                for (auto i=0; i < nodes; ++i)
+                        queries.push_back(2*key_distribution(random_engine) + (hit(random_engine) ? 0 : 1));
+                std::size_t misses = 0, false_positives = 0;
+                for (const auto elem : queries) {
+                        if (elem % 2 != 0) {
+                                ++misses;
+                                false_positives += filtered_BST.may_contain(elem);
+                        }
+                }
+                auto lookup = [&checksum](const BST<int, int>& bst, int k) {
+                        auto found = bst.find(k);
+                        if (found != bst.cend())
+                                checksum += found->second;
+                };
+                std::cout << hit_ratio << " " << average_lookup_time(queries, [&plain_BST, &lookup](int k) {
+                        lookup(plain_BST, k);
+                }) << " " << average_lookup_time(queries, [&filtered_BST, &lookup](int k) {
+                        lookup(filtered_BST, k);
+                }) << " " << (misses ? double(false_positives)/misses : 0) << std::endl;
+        }
+        std::cout << "(checksum " << checksum << ")" << std::endl;
+}
+
+//URL-like keys that share long prefixes: a few hosts, two levels of path segments and a numbered item
+std::vector<std::string> url_keys(int nodes){
+        const char* segments[] = {"electronics", "garden", "kitchen", "books", "sports", "toys", "clothing", "music",
+                                  "automotive", "health", "office", "outdoor", "furniture", "jewelry", "software", "video-games"};
+        std::vector<std::string> keys;
+        for (auto i=0; i < nodes; ++i) {
+                unsigned id = random_engine();
+                keys.push_back("https://www.shop" + std::to_string(id % 8) + ".example.com/" + segments[id / 8 % 16] + "/" + segments[id / 128 % 16] +
+                               "/item-" + std::to_string(id / 2048 % 1000000) + "?ref=" + std::to_string(i));
+        }
+        return keys;
+}
+
+//memory and lookup time of string keys in the generic BST and in the radix tree; bytes per key are the live heap bytes
+//after building, the key strings included
+void radix_benchmark(int nodes){
+        std::vector<std::string> keys = url_keys(nodes);
+        std::vector<int> queries;
+        for (auto i=0; i < nodes; ++i)
+                queries.push_back(i);
+        std::shuffle (queries.begin(), queries.end(), random_engine);
+
+        std::size_t bytes_before = live_bytes;
+        BST<std::string, int> string_BST;
+        for (const auto elem : queries)
+                string_BST.insert(keys[elem], elem);
+        string_BST.balance();
+        double BST_bytes = double(live_bytes - bytes_before)/nodes;
+
+        bytes_before = live_bytes;
+        RadixTree<int> radix_tree;
+        for (const auto elem : queries)
+                radix_tree.insert(keys[elem], elem);
+        double radix_bytes = double(live_bytes - bytes_before)/nodes;
+        std::shuffle (queries.begin(), queries.end(), random_engine);
+
+        std::size_t key_bytes = 0;
+        for (const auto& elem : keys)
+                key_bytes += elem.size();
+        long long checksum = 0;
+        std::cout << "Lookups of " << nodes << " URL-like keys of " << double(key_bytes)/nodes << " characters on average in: nanoseconds" << std::endl;
+        std::cout << "structure" << " " << "bytes per key" << " " << "find" << " " << "contains" << std::endl;
+        std::cout << "BST(balanced)" << " " << BST_bytes << " " << average_lookup_time(queries, [&string_BST, &keys, &checksum](int i) {
+                checksum += string_BST.find(keys[i])->second;
+        }) << " " << average_lookup_time(queries, [&string_BST, &keys, &checksum](int i) {
+                checksum += string_BST.contains(keys[i]);
+        }) << std::endl;
+        std::cout << "RadixTree" << " " << radix_bytes << " " << average_lookup_time(queries, [&radix_tree, &keys, &checksum](int i) {
+                checksum += radix_tree.find(keys[i])->second;
+        }) << " " << average_lookup_time(queries, [&radix_tree, &keys, &checksum](int i) {
+                checksum += radix_tree.contains(keys[i]);
+        }) << std::endl;
+        std::cout << "(checksum " << checksum << ")" << std::endl;
+}
+
+//builds, balances and destroys a tree from shuffled inserts with the default allocator and with std::pmr resources
+void allocator_benchmark(int nodes){
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+
+        auto build = [&input_keys](auto& bst) {
+                auto start_time = std::chrono::high_resolution_clock::now();
+                for (auto elem : input_keys)
+                        bst.insert(elem, elem);
+                bst.balance();
+                auto end_time = std::chrono::high_resolution_clock::now();
+                return std::chrono::duration_cast<std::chrono::milliseconds>(end_time-start_time).count();
+        };
+        using pmr_allocator = std::pmr::polymorphic_allocator<std::pair<const int, int> >;
+
+        std::cout << "Building and balancing a BST of " << nodes << " nodes" << std::endl;
+        std::cout << "allocator" << " " << "node bytes" << " " << "build in milliseconds" << " " << "destroy in milliseconds" << std::endl;
+        {
+                auto bst = std::make_unique<BST<int, int> >();
+                auto build_time = build(*bst);
+                auto usage = bst->memory_usage();
+                auto start_time = std::chrono::high_resolution_clock::now();
+                bst.reset();
+                auto end_time = std::chrono::high_resolution_clock::now();
+                std::cout << "std::allocator" << " " << double(usage.node_bytes)/usage.nodes << " " << build_time << " "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(end_time-start_time).count() << std::endl;
+        }
+        {
+                std::pmr::unsynchronized_pool_resource pool;
+                auto bst = std::make_unique<PmrBST<int, int> >(pmr_allocator(&pool));
+                auto build_time = build(*bst);
+                auto usage = bst->memory_usage();
+                auto start_time = std::chrono::high_resolution_clock::now();
+                bst.reset();
+                auto end_time = std::chrono::high_resolution_clock::now();
+                std::cout << "unsynchronized_pool_resource" << " " << double(usage.node_bytes)/usage.nodes << " " << build_time << " "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(end_time-start_time).count() << std::endl;
+        }
+        {
+                //deallocation is a no-op for the arena, whose memory goes back in one piece afterwards
+                auto arena = std::make_unique<std::pmr::monotonic_buffer_resource>();
+                auto bst = std::make_unique<PmrBST<int, int> >(pmr_allocator(arena.get()));
+                auto build_time = build(*bst);
+                auto usage = bst->memory_usage();
+                auto start_time = std::chrono::high_resolution_clock::now();
+                bst.reset();
+                arena.reset();
+                auto end_time = std::chrono::high_resolution_clock::now();
+                std::cout << "monotonic_buffer_resource" << " " << double(usage.node_bytes)/usage.nodes << " " << build_time << " "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(end_time-start_time).count() << std::endl;
+        }
+}
+
+//re-sharding by key range: split and join against copying the upper half into a new tree, and merge against inserting
+//one tree into another; the baselines insert in shuffled order, as sorted inserts would degenerate the tree
+void partition_benchmark(int nodes){
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        BST<int, int> bst;
+        for (auto elem : input_keys)
+                bst.insert(elem, elem);
+        bst.balance();
+        auto elapsed = [](auto start_time) {
+                return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now()-start_time).count();
+        };
+
+        std::cout << "Partitioning a balanced BST of " << nodes << " nodes in: microseconds" << std::endl;
+        auto start_time = std::chrono::high_resolution_clock::now();
+        std::pair<BST<int, int>, BST<int, int> > halves = bst.split(nodes/2);
+        std::cout << "split" << " " << elapsed(start_time) << std::endl;
+        start_time = std::chrono::high_resolution_clock::now();
+        bst = BST<int, int>::join(std::move(halves.first), std::move(halves.second));
+        std::cout << "join" << " " << elapsed(start_time) << std::endl;
+
+        start_time = std::chrono::high_resolution_clock::now();
+        std::vector<std::pair<int, int> > upper_half(bst.lower_bound(nodes/2), bst.cend());
+        std::shuffle (upper_half.begin(), upper_half.end(), random_engine);
+        BST<int, int> upper_BST;
+        for (const auto& data_pair : upper_half) {
+                upper_BST.insert(data_pair.first, data_pair.second);
+                bst.erase(data_pair.first);
+        }
+        std::cout << "copy upper half by insert and erase" << " " << elapsed(start_time) << std::endl;
+
+        //the other tree holds the even keys below nodes: it overlaps half of the remaining lower half and extends past it
+        BST<int, int> other_BST;
+        std::vector<int> other_keys;
+        for (auto i=0; i < nodes/2; ++i)
+                other_keys.push_back(2*i);
+        std::shuffle (other_keys.begin(), other_keys.end(), random_engine);
+        for (auto elem : other_keys)
+                other_BST.insert(elem, -elem);
+        BST<int, int> insert_BST = bst;
+        BST<int, int> other_copy = other_BST;
+        start_time = std::chrono::high_resolution_clock::now();
+        bst.merge(other_BST);
+        std::cout << "merge" << " " << elapsed(start_time) << std::endl;
+        start_time = std::chrono::high_resolution_clock::now();
+        std::vector<std::pair<int, int> > other_pairs(other_copy.cbegin(), other_copy.cend());
+        std::shuffle (other_pairs.begin(), other_pairs.end(), random_engine);
+        for (const auto& data_pair : other_pairs)
+                insert_BST.insert(data_pair.first, data_pair.second);
+        std::cout << "merge by insert" << " " << elapsed(start_time) << std::endl;
+        std::cout << "(sizes " << bst.size() << " " << insert_BST.size() << ")" << std::endl;
+}
+
+//million keys per second when threads call insert_slice(first, last) on disjoint slices of [0, nodes)
+template <class InsertSlice>
+double threaded_throughput(int nodes, unsigned threads, InsertSlice insert_slice){
+        auto start_time = std::chrono::high_resolution_clock::now();
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; ++t)
+                pool.emplace_back(insert_slice, std::size_t(nodes) * t / threads, std::size_t(nodes) * (t + 1) / threads);
+        for (auto& thread : pool)
+                thread.join();
+        auto end_time = std::chrono::high_resolution_clock::now();
+        return nodes / std::chrono::duration<double>(end_time-start_time).count() / 1e6;
+}
+
+//insert throughput of T threads writing disjoint slices of shuffled keys: one BST behind a mutex, ShardedBST::insert
+//and ShardedBST::insert_bulk over the whole input
+void sharded_benchmark(int nodes){
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        std::vector<std::pair<int, int> > input_pairs;
+        for (auto elem : input_keys)
+                input_pairs.emplace_back(elem, elem);
+        std::cout << "Inserting " << nodes << " shuffled keys on " << std::thread::hardware_concurrency() << " hardware threads in: million keys per second" << std::endl;
+        std::cout << "threads" << " " << "BST(mutex)" << " " << "ShardedBST::insert" << " " << "ShardedBST::insert_bulk" << std::endl;
+        for (unsigned threads : {1u, 2u, 4u, 8u}) {
+                BST<int, int> locked_BST;
+                std::mutex lock;
+                double locked = threaded_throughput(nodes, threads, [&locked_BST, &lock, &input_keys](std::size_t first, std::size_t last) {
+                        for (std::size_t i = first; i < last; ++i) {
+                                std::lock_guard<std::mutex> guard(lock);
+                                locked_BST.insert(input_keys[i], input_keys[i]);
+                        }
+                });
+                ShardedBST<int, int> sharded_BST;
+                double sharded = threaded_throughput(nodes, threads, [&sharded_BST, &input_keys](std::size_t first, std::size_t last) {
+                        for (std::size_t i = first; i < last; ++i)
+                                sharded_BST.insert(input_keys[i], input_keys[i]);
+                });
+                ShardedBST<int, int> bulk_BST;
+                auto start_time = std::chrono::high_resolution_clock::now();
+                bulk_BST.insert_bulk(input_pairs.begin(), input_pairs.end(), threads);
+                auto end_time = std::chrono::high_resolution_clock::now();
+                double bulk = nodes / std::chrono::duration<double>(end_time-start_time).count() / 1e6;
+                std::cout << threads << " " << locked << " " << sharded << " " << bulk << std::endl;
+        }
+}
+
+//insert throughput of T threads writing disjoint slices of shuffled keys into one BST through flat combining,
+//into a mutex-wrapped BST and into a mutex-wrapped std::map
+void combining_benchmark(int nodes){
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+
+        std::cout << "Inserting " << nodes << " shuffled keys on " << std::thread::hardware_concurrency() << " hardware threads in: million keys per second" << std::endl;
+        std::cout << "threads" << " " << "CombiningBST" << " " << "average_batch" << " " << "BST(mutex)" << " " << "std::map(mutex)" << std::endl;
+        for (unsigned threads : {1u, 2u, 4u, 8u, 16u}) {
+                CombiningBST<int, int> combining_BST;
+                double combining = threaded_throughput(nodes, threads, [&combining_BST, &input_keys](std::size_t first, std::size_t last) {
+                        for (std::size_t i = first; i < last; ++i)
+                                combining_BST.insert(input_keys[i], input_keys[i]);
+                });
+                BST<int, int> locked_BST;
+                std::mutex BST_lock;
+                double locked = threaded_throughput(nodes, threads, [&locked_BST, &BST_lock, &input_keys](std::size_t first, std::size_t last) {
+                        for (std::size_t i = first; i < last; ++i) {
+                                std::lock_guard<std::mutex> guard(BST_lock);
+                                locked_BST.insert(input_keys[i], input_keys[i]);
+                        }
+                });
+                std::map<int, int> locked_map;
+                std::mutex map_lock;
+                double map = threaded_throughput(nodes, threads, [&locked_map, &map_lock, &input_keys](std::size_t first, std::size_t last) {
+                        for (std::size_t i = first; i < last; ++i) {
+                                std::lock_guard<std::mutex> guard(map_lock);
+                                locked_map[input_keys[i]] = input_keys[i];
+                        }
+                });
+                std::cout << threads << " " << combining << " " << combining_BST.combining_stats().average_batch() << " " << locked << " " << map << std::endl;
+        }
+}
+
+//a reader and a writer thread keep working while the tree is rebalanced, first by the blocking balance(), then by
+//rebalance_async(); the longest single find shows how long readers stall
+void rebalance_benchmark(int nodes){
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(2*i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+
+        std::cout << "Rebalancing " << nodes << " nodes while one thread reads and one writes" << std::endl;
+        std::cout << "method" << " " << "rebuild_ms" << " " << "reads" << " " << "writes" << " " << "longest_read_us" << std::endl;
+        for (bool background : {false, true}) {
+                ConcurrentBST<int, int> tree;
+                for (auto elem : input_keys)
+                        tree.insert(elem, elem);
+                std::atomic<bool> done{false};
+                std::atomic<std::size_t> reads{0}, writes{0};
+                std::atomic<long long> longest_read{0};
+                std::thread reader([&tree, &done, &reads, &longest_read, nodes]() {
+                        std::mt19937 engine(1);
+                        std::uniform_int_distribution<int> distribution(0, 2*nodes);
+                        while (!done.load()) {
+                                auto start_time = std::chrono::high_resolution_clock::now();
+                                tree.find(distribution(engine));
+                                auto end_time = std::chrono::high_resolution_clock::now();
+                                long long duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time-start_time).count();
+                                if (duration > longest_read.load())
+                                        longest_read.store(duration);
+                                ++reads;
+                        }
+                });
+                std::thread writer([&tree, &done, &writes]() {
+                        for (int i = 1; !done.load(); i += 2) {
+                                tree.insert(i, i);
+                                ++writes;
+                        }
+                });
+                auto start_time = std::chrono::high_resolution_clock::now();
+                if (background) {
+                        tree.rebalance_async();
+                        tree.wait_rebalance();
+                }
+                else
+                        tree.balance();
+                auto end_time = std::chrono::high_resolution_clock::now();
+                done.store(true);
+                reader.join();
+                writer.join();
+                std::cout << (background ? "rebalance_async()" : "balance()") << " " << std::chrono::duration_cast<std::chrono::milliseconds>(end_time-start_time).count() << " "
+                          << reads.load() << " " << writes.load() << " " << longest_read.load() << std::endl;
+        }
+}
+
+//time-ordered appends past the largest key, without and with the previous insert as hint, then sorted batches of k
+//lookups from the root and by finger search from the previous result
+void finger_benchmark(int nodes){
+        BST<int, int> bst;
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        for (auto elem : input_keys)
+                bst.insert(elem, elem);
+        bst.balance();
+
+        int appends = std::min(nodes, 10000);
+        std::cout << "Appending " << appends << " increasing keys to " << nodes << " nodes in: nanoseconds per insert" << std::endl;
+        std::cout << "insert(k, v)" << " " << "insert(hint, k, v)" << std::endl;
+        for (bool hinted : {false, true}) {
+                BST<int, int> appended = bst;
+                BST<int, int>::Iterator last_inserted = appended.find(nodes - 1);
+                auto start_time = std::chrono::high_resolution_clock::now();
+                for (int i = nodes; i < nodes + appends; ++i) {
+                        if (hinted)
+                                last_inserted = appended.insert(last_inserted, i, i);
+                        else
+                                appended.insert(i, i);
+                }
+                auto end_time = std::chrono::high_resolution_clock::now();
+                std::cout << std::chrono::duration_cast<std::chrono::nanoseconds>(end_time-start_time).count()/double(appends) << (hinted ? "\n" : " ");
+        }
+
+        long long checksum = 0;
+        std::cout << "Sorted batches of k lookups on " << nodes << " nodes in: nanoseconds per lookup" << std::endl;
+        std::cout << "k" << " " << "find" << " " << "find_from" << std::endl;
+        for (int batch = std::min(16, nodes); ; batch = std::min(16 * batch, nodes)) {
+                std::vector<int> queries(input_keys.begin(), input_keys.begin() + batch);
+                std::sort(queries.begin(), queries.end());
+                int repeats = std::max(1, nodes / batch / 16);
+                double from_root = 0, from_finger = 0;
+                for (int repeat = 0; repeat < repeats; ++repeat) {
+                        from_root += average_lookup_time(queries, [&bst, &checksum](int k) {
+                                checksum += bst.find(k)->second;
+                        });
+                        BST<int, int>::ConstIterator finger = bst.cend();
+                        from_finger += average_lookup_time(queries, [&bst, &checksum, &finger](int k) {
+                                finger = bst.find_from(finger, k);
+                                checksum += finger->second;
+                        });
+                }
+                std::cout << batch << " " << from_root / repeats << " " << from_finger / repeats << std::endl;
+                if (batch == nodes)
+                        break;
+        }
+        std::cout << "(checksum " << checksum << ")" << std::endl;
+}
+
+//sorted batches of k keys, about half of them stored, looked up by a loop of find, by find_from from the previous
+//result and by one find_sorted descent, from one key in 4096 up to as many queries as nodes
+void sorted_lookup_benchmark(int nodes){
+        BST<int, int> bst;
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(2*i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        for (auto elem : input_keys)
+                bst.insert(elem, elem);
+        bst.balance();
+        std::uniform_int_distribution<int> distribution(0, 2*nodes - 1);
+
+        long long checksum = 0;
+        std::cout << "Sorted batches of k lookups on " << nodes << " nodes in: nanoseconds per lookup" << std::endl;
+        std::cout << "k" << " " << "find" << " " << "find_from" << " " << "find_sorted" << std::endl;
+        for (int batch = std::max(1, nodes / 4096); ; batch = std::min(4 * batch, nodes)) {
+                std::vector<int> queries;
+                for (int i = 0; i < batch; ++i)
+                        queries.push_back(distribution(random_engine));
+                std::sort(queries.begin(), queries.end());
+                std::vector<BST<int, int>::ConstIterator> results(batch);
+                int repeats = std::max(1, nodes / batch / 16);
+                double loop = 0, finger = 0, merge_walk = 0;
+                for (int repeat = 0; repeat < repeats; ++repeat) {
+                        loop += average_lookup_time(queries, [&bst, &checksum](int k) {
+                                BST<int, int>::ConstIterator found = bst.find(k);
+                                checksum += found != bst.cend() ? found->second : 0;
+                        });
+                        BST<int, int>::ConstIterator previous = bst.cend();
+                        finger += average_lookup_time(queries, [&bst, &checksum, &previous](int k) {
+                                BST<int, int>::ConstIterator found = bst.find_from(previous, k);
+                                if (found != bst.cend()) {
+                                        checksum += found->second;
+                                        previous = found;
+                                }
+                        });
+                        auto start_time = std::chrono::high_resolution_clock::now();
+                        bst.find_sorted(queries.begin(), queries.end(), results.begin());
+                        for (const auto& found : results)
+                                checksum += found != bst.cend() ? found->second : 0;
+                        auto end_time = std::chrono::high_resolution_clock::now();
+                        merge_walk += std::chrono::duration_cast<std::chrono::nanoseconds>(end_time-start_time).count()/double(batch);
+                }
+                std::cout << batch << " " << loop / repeats << " " << finger / repeats << " " << merge_walk / repeats << std::endl;
+                if (batch == nodes)
+                        break;
+        }
+        std::cout << "(checksum " << checksum << ")" << std::endl;
+}
+
+//moves every other key of a tree with 32 character string values into a second tree, by find, insert and erase and by
+//extract and insert of the node handle, counting the heap allocations per moved key
+void node_handle_benchmark(int nodes){
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        std::vector<int> moved_keys;
+        for (auto elem : input_keys)
+                if (elem % 2 == 0)
+                        moved_keys.push_back(elem);
+
+        std::cout << "Moving " << moved_keys.size() << " of " << nodes << " keys with string values into another tree in: nanoseconds per key" << std::endl;
+        std::cout << "method" << " " << "time" << " " << "allocations" << std::endl;
+        for (bool handles : {false, true}) {
+                BST<int, std::string> source, target;
+                for (auto elem : input_keys)
+                        source.insert(elem, std::string(32, char('a' + elem % 26)));
+                source.balance();
+                std::size_t allocations_before = allocation_count;
+                auto start_time = std::chrono::high_resolution_clock::now();
+                for (auto elem : moved_keys) {
+                        if (handles)
+                                target.insert(source.extract(elem));
+                        else {
+                                target.insert(elem, source.find(elem)->second);
+                                source.erase(elem);
+                        }
+                }
+                auto end_time = std::chrono::high_resolution_clock::now();
+                std::cout << (handles ? "extract/insert(node)" : "find/insert/erase") << " " << std::chrono::duration_cast<std::chrono::nanoseconds>(end_time-start_time).count()/double(moved_keys.size())
+                          << " " << double(allocation_count - allocations_before)/moved_keys.size() << std::endl;
+        }
+}
+
+//random lookups on the same balanced tree with its nodes where balance() allocated them, then after compact() into
+//breadth-first and into van Emde Boas order
+void layout_benchmark(int nodes){
+        std::map<int, int> map;
+        BST<int, int> tree;
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        for (auto elem : input_keys) {
+                map.insert({elem, elem});
+                tree.insert(elem, elem);
+        }
+        tree.balance();
+        std::vector<int> queries(input_keys.begin(), input_keys.begin() + std::min(nodes, 1000000));
+        std::shuffle (queries.begin(), queries.end(), random_engine);
+
+        long long checksum = 0;
+        std::cout << "Random lookups on " << nodes << " nodes by node layout in: nanoseconds (compact in milliseconds)" << std::endl;
+        std::cout << "layout" << " " << "lookup" << " " << "compact" << std::endl;
+        std::cout << "map" << " " << average_lookup_time(queries, [&map, &checksum](int k) {
+                checksum += map.find(k)->second;
+        }) << " " << 0 << std::endl;
+        std::cout << "balance()" << " " << average_lookup_time(queries, [&tree, &checksum](int k) {
+                checksum += tree.find(k)->second;
+        }) << " " << 0 << std::endl;
+        for (auto layout : {NodeLayout::breadth_first, NodeLayout::van_emde_boas}) {
+                auto start_time = std::chrono::high_resolution_clock::now();
+                tree.compact(layout);
+                auto end_time = std::chrono::high_resolution_clock::now();
+                std::cout << (layout == NodeLayout::breadth_first ? "compact(BFS)" : "compact(vEB)") << " " << average_lookup_time(queries, [&tree, &checksum](int k) {
+                        checksum += tree.find(k)->second;
+                }) << " " << std::chrono::duration_cast<std::chrono::milliseconds>(end_time-start_time).count() << std::endl;
+        }
+        std::cout << "(checksum " << checksum << ")" << std::endl;
+}
+
+//counts the dTLB load misses of this thread between start() and stop(); stop() returns -1 where perf events are not permitted
+class DtlbMissCounter {
+int fd;
+public:
+DtlbMissCounter() {
+        perf_event_attr attributes{};
+        attributes.type = PERF_TYPE_HW_CACHE;
+        attributes.size = sizeof(attributes);
+        attributes.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attributes.disabled = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+}
+DtlbMissCounter(const DtlbMissCounter&) = delete;
+DtlbMissCounter& operator=(const DtlbMissCounter&) = delete;
+~DtlbMissCounter() {
+        if (fd >= 0)
+                close(fd);
+}
+void start() {
+        if (fd < 0)
+                return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+long long stop() {
+        long long count = -1;
+        if (fd < 0)
+                return count;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+                count = -1;
+        return count;
+}
+};
+
+//the transparent huge pages of the process, in MB
+long anon_huge_megabytes(){
+        std::ifstream smaps("/proc/self/smaps_rollup");
+        std::string field;
+        long kilobytes = 0;
+        while (smaps >> field) {
+                if (field == "AnonHugePages:") {
+                        smaps >> kilobytes;
+                        break;
+                }
+        }
+        return kilobytes / 1024;
+}
+
+//random lookups in trees built from shuffled inserts with std::allocator and on a HugePageResource with 4 KB and with 2 MB
+//pages, with the dTLB load misses per lookup
+void huge_page_benchmark(int nodes){
+        std::vector<int> input_keys;
+        for (auto i=0; i < nodes; ++i)
+                input_keys.push_back(i);
+        std::shuffle (input_keys.begin(), input_keys.end(), random_engine);
+        std::vector<int> queries(input_keys.begin(), input_keys.begin() + std::min(nodes, 1000000));
+        std::shuffle (queries.begin(), queries.end(), random_engine);
+
+        long long checksum = 0;
+        DtlbMissCounter counter;
+        auto report = [&queries, &counter](const char* storage, auto& tree, long huge_megabytes) {
+                long long checksum = 0;
+                counter.start();
+                double time = average_lookup_time(queries, [&tree, &checksum](int k) {
+                        checksum += tree.find(k)->second;
+                });
+                long long misses = counter.stop();
+                std::cout << storage << " " << time << " ";
+                if (misses < 0)
+                        std::cout << "n/a";
+                else
+                        std::cout << double(misses)/queries.size();
+                std::cout << " " << huge_megabytes << std::endl;
+                return checksum;
+        };
+        std::cout << "Random lookups on " << nodes << " nodes by node storage in: nanoseconds, dTLB load misses per lookup, MB on huge pages" << std::endl;
+        std::cout << "storage" << " " << "lookup" << " " << "dTLB_misses" << " " << "huge_MB" << std::endl;
+        {
+                BST<int, int> tree;
+                for (auto elem : input_keys)
+                        tree.insert(elem, elem);
+                checksum += report("std::allocator", tree, anon_huge_megabytes());
+        }
+        for (bool huge_pages : {false, true}) {
+                HugePageResource resource(huge_pages);
+                PmrBST<int, int> tree{std::pmr::polymorphic_allocator<std::pair<const int, int> >(&resource)};
+                for (auto elem : input_keys)
+                        tree.insert(elem, elem);
+                long huge_megabytes = huge_pages ? std::max<long>(resource.reserved_bytes() >> 20, anon_huge_megabytes()) : 0;
+                checksum += report(huge_pages ? "HugePageResource(2MB)" : "HugePageResource(4KB)", tree, huge_megabytes);
+        }
+        std::cout << "(checksum " << checksum << ")" << std::endl;
+}
+
+//a constant table of 256 codes with odd gaps, as a constexpr StaticMap needs it at compile time
+struct StaticTable {
+        StaticMapEntry<int, int> entries[256];
+};
+constexpr StaticTable static_table(){
+        StaticTable table{};
+        for (int i=0; i < 256; ++i) {
+                table.entries[i].first = (i * 167) % 256 * 3 + 1;
+                table.entries[i].second = i;
+        }
+        return table;
+}
+
+//random lookups in a 256 entry table as a compile-time StaticMap, a balanced BST and std::map, and the time to build the
+//latter two from the table at startup
+void static_map_benchmark(){
+        constexpr StaticMap<int, int, 256> static_map{static_table().entries};
+        constexpr StaticTable table = static_table();
+
+        auto start_time = std::chrono::high_resolution_clock::now();
+        std::map<int, int> map;
+        for (const auto& entry : table.entries)
+                map.insert({entry.first, entry.second});
+        auto end_time = std::chrono::high_resolution_clock::now();
+        double map_build = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time-start_time).count();
+        start_time = std::chrono::high_resolution_clock::now();
+        BST<int, int> balanced_BST;
+        for (const auto& entry : table.entries)
+                balanced_BST.insert(entry.first, entry.second);
+        balanced_BST.balance();
+        end_time = std::chrono::high_resolution_clock::now();
+        double BST_build = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time-start_time).count();
+
+        std::uniform_int_distribution<int> pick(0, 255);
+        std::vector<int> queries;
+        for (auto i=0; i < 10000000; ++i)
+                queries.push_back(table.entries[pick(random_engine)].first);
+
+        long long checksum = 0;
+        std::cout << "Random lookups in a table of 256 entries in: nanoseconds (build in microseconds)" << std::endl;
+        std::cout << "container" << " " << "lookup" << " " << "build" << std::endl;
+        std::cout << "map" << " " << average_lookup_time(queries, [&map, &checksum](int k) {
+                checksum += map.find(k)->second;
+        }) << " " << map_build/1000 << std::endl;
+        std::cout << "BST(balanced)" << " " << average_lookup_time(queries, [&balanced_BST, &checksum](int k) {
+                checksum += balanced_BST.find(k)->second;
+        }) << " " << BST_build/1000 << std::endl;
+        std::cout << "StaticMap" << " " << average_lookup_time(queries, [&static_map, &checksum](int k) {
+                checksum += static_map.find(k)->second;
+        }) << " " << 0 << std::endl;
+        std::cout << "(checksum " << checksum << ")" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+        std::string mode = argc > 1 ? argv[1] : "lookup";
+        int nodes = argc > 2 ? std::stoi(argv[2]) : 10000000;
+
+        if (mode == "iteration")
+                iteration_benchmark(nodes);
+        else if (mode == "parallel")
+                parallel_benchmark(nodes);
+        else if (mode == "snapshot")
+                snapshot_benchmark(nodes);
+        else if (mode == "textload")
+                text_load_benchmark(nodes);
+        else if (mode == "constscan")
+                const_scan_benchmark(nodes);
+        else if (mode == "stringlookup")
+                string_lookup_benchmark(nodes);
+        else if (mode == "zipf")
+                zipf_benchmark(nodes, argc > 3 ? std::stod(argv[3]) : 1.2);
+        else if (mode == "weighted")
+                weighted_benchmark(nodes, argc > 3 ? std::stod(argv[3]) : 1.2);
+        else if (mode == "cache")
+                cache_benchmark(nodes, argc > 3 ? std::stod(argv[3]) : 1.2);
+        else if (mode == "hashindex")
+                hash_index_benchmark(nodes);
+        else if (mode == "bloom")
+                bloom_benchmark(nodes);
+        else if (mode == "radix")
+                radix_benchmark(nodes);
+        else if (mode == "allocator")
+                allocator_benchmark(nodes);
+        else if (mode == "partition")
+                partition_benchmark(nodes);
+        else if (mode == "sharded")
+                sharded_benchmark(nodes);
+        else if (mode == "combining")
+                combining_benchmark(nodes);
+        else if (mode == "rebalance")
+                rebalance_benchmark(nodes);
+        else if (mode == "finger")
+                finger_benchmark(nodes);
+        else if (mode == "sortedlookup")
+                sorted_lookup_benchmark(nodes);
+        else if (mode == "nodehandle")
+                node_handle_benchmark(nodes);
+        else if (mode == "layout")
+                layout_benchmark(nodes);
+        else if (mode == "hugepage")
+                huge_page_benchmark(nodes);
+        else if (mode == "staticmap")
+                static_map_benchmark();
+        else
+                lookup_times_benchmark();
+}
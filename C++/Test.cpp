@@ -1,4 +1,26 @@
 #include "BST.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string_view>
+
+//a key with the comparisons only, no std::hash
+struct OrderedOnly {
+        int id;
+        bool operator<(const OrderedOnly& rhs) const {
+                return id < rhs.id;
+        }
+        bool operator>(const OrderedOnly& rhs) const {
+                return id > rhs.id;
+        }
+        bool operator==(const OrderedOnly& rhs) const {
+                return id == rhs.id;
+        }
+};
 
 int main(){
         //Demonstration of the functionality inside the Binary Search Tree class
@@ -58,6 +80,18 @@ int main(){
         //testing operator <<
         std::cout << BinarySearchTree;
 
+        //testing const iteration: range-for, operator-> and std:: algorithms on a const BST
+        const BST<int, int>& ConstView = BinarySearchTree;
+        int const_sum = 0;
+        for (const auto& data_pair : ConstView)
+                const_sum += data_pair.second;
+        if (const_sum == 55 && ConstView.cbegin()->first == 0) std::cout << "const range-for correct" << std::endl;
+        if (&*ConstView.cbegin() == &*BinarySearchTree.begin()) std::cout << "ConstIterator returns reference correct" << std::endl;
+        if (std::distance(ConstView.begin(), ConstView.end()) == 11 &&
+            std::count_if(ConstView.begin(), ConstView.end(), [](const std::pair<const int, int>& data_pair) {
+                        return data_pair.second % 2 == 0;
+                }) == 6) std::cout << "std algorithms on const BST correct" << std::endl;
+
         //const BST<int, int> ConstBST{};
         //std::cout << ConstBST[4] << std::endl; //causes std::runtime_error
         const BST<int, int> ConstBinarySearchTree = BinarySearchTree;
@@ -80,6 +114,454 @@ int main(){
         std::cout << "original" << std::endl;
         std::cout << BinarySearchTree;
 
+        //testing order statistics: size(), rank(const key k), select(std::size_t i), count_range(const key a, const key b)
+        if (BinarySearchTree.size() == 11) std::cout << "size correct" << std::endl;
+        if (BinarySearchTree.rank(5) == 5) std::cout << "rank correct" << std::endl;
+        if ((*BinarySearchTree.select(7)).first == 7) std::cout << "select correct" << std::endl;
+        if (BinarySearchTree.select(11) == BinarySearchTree.cend()) std::cout << "select out of range correct" << std::endl;
+        if (BinarySearchTree.count_range(2, 9) == 7) std::cout << "count_range correct" << std::endl;
+        std::cout << "90th percentile key: " << (*BinarySearchTree.select(BinarySearchTree.size()*9/10)).first << std::endl;
+
+        //testing function: bool erase(const key k)
+        BinarySearchTree.erase(5);
+        BinarySearchTree.erase(0);
+        BinarySearchTree.erase(10);
+        if (!BinarySearchTree.erase(42)) std::cout << "erase of missing key correct" << std::endl;
+        if (BinarySearchTree.size() == 8 && BinarySearchTree.rank(6) == 4) std::cout << "erase correct" << std::endl;
+        std::cout << BinarySearchTree;
+
+        //testing function: void for_each(F f) non-const and const
+        BinarySearchTree.for_each([](std::pair<const int, int>& data_pair) {
+                data_pair.second *= 2;
+        });
+        int visited = 0;
+        ConstBinarySearchTree.for_each([&visited](const std::pair<const int, int>& data_pair) {
+                if (data_pair.first == visited) ++visited;
+        });
+        if (visited == 11 && BinarySearchTree[9] == 18) std::cout << "for_each correct" << std::endl;
+
+        //testing functions: parallel_for_each(F f), parallel_reduce(T init, Reduce op), parallel_transform_reduce(T init, Reduce op, Transform transform)
+        BST<int, int> ParallelTree;
+        for (int i=0; i < 1000; ++i)
+                ParallelTree.insert((i*7919)%1000, i);
+        ParallelTree.balance();
+        ParallelTree.parallel_for_each([](std::pair<const int, int>& data_pair) {
+                data_pair.second = data_pair.first;
+        }, 4);
+        if (ParallelTree.parallel_reduce(0, std::plus<int>(), 4) == 499500) std::cout << "parallel_reduce correct" << std::endl;
+        std::string ordered_keys = ParallelTree.parallel_transform_reduce(std::string{}, std::plus<std::string>(), [](const std::pair<const int, int>& data_pair) {
+                return std::to_string(data_pair.first % 10);
+        }, 4);
+        if (ordered_keys.substr(0, 12) == "012345678901") std::cout << "parallel_transform_reduce keeps key order" << std::endl;
+
+        //testing functions: void save(const std::string& path), void load(const std::string& path) and the mapped BSTSnapshot view
+        ParallelTree.save("snapshot_test.bin");
+        BST<int, int> LoadedTree;
+        LoadedTree.load("snapshot_test.bin");
+        if (LoadedTree.size() == 1000 && (*LoadedTree.find(777)).second == 777) std::cout << "load correct" << std::endl;
+        {
+                BSTSnapshot<int, int> SnapshotView("snapshot_test.bin");
+                if (SnapshotView.size() == 1000 && SnapshotView[123] == 123 && SnapshotView.find(1000) == SnapshotView.cend()) std::cout << "snapshot view correct" << std::endl;
+                int previous = -1;
+                bool ordered = true;
+                for (const auto& data_pair : SnapshotView) {
+                        ordered = ordered && previous < data_pair.first;
+                        previous = data_pair.first;
+                }
+                if (ordered) std::cout << "snapshot view iteration correct" << std::endl;
+        }
+        {
+                //a forged count whose length wraps around to the real one has to be rejected
+                std::fstream forged("snapshot_test.bin", std::ios::in | std::ios::out | std::ios::binary);
+                std::uint64_t forged_count = 1000 + (std::uint64_t(1) << 61);
+                forged.seekp(offsetof(BSTSnapshotHeader, count));
+                forged.write(reinterpret_cast<const char*>(&forged_count), sizeof(forged_count));
+        }
+        try {
+                BSTSnapshot<int, int> ForgedView("snapshot_test.bin");
+        }
+        catch (const std::runtime_error&) {
+                std::cout << "forged snapshot count rejected correct" << std::endl;
+        }
+        std::remove("snapshot_test.bin");
+
+        //testing functions: void load_text(const std::string& path), void assign_sorted(RandomIt first, RandomIt last)
+        {
+                std::ofstream text_file("load_text_test.txt");
+                text_file << "3 30\n1,10\n\n2;20\n 3\t33\r\n-4 -40\n";
+        }
+        BST<int, int> TextTree;
+        TextTree.load_text("load_text_test.txt");
+        if (TextTree.size() == 4 && TextTree[3] == 33 && (*TextTree.cbegin()).first == -4) std::cout << "load_text correct" << std::endl;
+        std::remove("load_text_test.txt");
+        std::vector<std::pair<int, int> > sorted_pairs{{1, 1}, {2, 4}, {3, 9}, {4, 16}};
+        TextTree.assign_sorted(sorted_pairs.begin(), sorted_pairs.end());
+        if (TextTree.size() == 4 && TextTree[4] == 16) std::cout << "assign_sorted correct" << std::endl;
+
+        //testing heterogeneous lookup: find, lower_bound, upper_bound and operator[] with const char* and std::string_view
+        BST<std::string, int> StringTree;
+        StringTree.insert("banana", 2);
+        StringTree.insert("apple", 1);
+        StringTree.insert("cherry", 3);
+        std::string_view cherry{"cherry"};
+        if ((*StringTree.find("banana")).second == 2 && StringTree.find(cherry)->second == 3) std::cout << "heterogeneous find correct" << std::endl;
+        if (StringTree.lower_bound("b")->first == "banana" && StringTree.upper_bound("banana")->first == "cherry" &&
+            StringTree.lower_bound("d") == StringTree.cend()) std::cout << "lower_bound and upper_bound correct" << std::endl;
+        StringTree[std::string_view{"date"}] = 4;
+        if (StringTree["date"] == 4 && StringTree.size() == 4) std::cout << "heterogeneous operator[] correct" << std::endl;
+
+        //testing splay mode: void set_splay_mode(SplayMode mode, unsigned every_kth_access)
+        BST<int, int> SplayTree = ParallelTree;
+        SplayTree.set_splay_mode(SplayMode::full);
+        for (int i=0; i < 10; ++i)
+                SplayTree.find(i % 3 == 0 ? 42 : 900 + i);
+        SplayTree.set_splay_mode(SplayMode::semi, 2);
+        SplayTree[7] = -7;
+        if (SplayTree.size() == 1000 && SplayTree.rank(500) == 500 && SplayTree[7] == -7 &&
+            std::distance(SplayTree.begin(), SplayTree.end()) == 1000) std::cout << "splay mode correct" << std::endl;
+
+        //testing access-weighted rebuild: set_access_sampling(unsigned every_kth_find), balance_weighted(), weighted_path_length()
+        BST<int, int> WeightedTree = ParallelTree;
+        WeightedTree.set_access_sampling(1);
+        for (int i=0; i < 100; ++i)
+                WeightedTree.find(i % 10 == 0 ? i : 999);
+        double balanced_path_length = WeightedTree.weighted_path_length();
+        WeightedTree.balance_weighted();
+        if (WeightedTree.weighted_path_length() < balanced_path_length && WeightedTree.size() == 1000 && WeightedTree.rank(999) == 999)
+                std::cout << "balance_weighted correct" << std::endl;
+
+        //testing lookup cache: set_lookup_cache(std::size_t slots), lookup_cache_stats()
+        BST<int, int> CachedTree = ParallelTree;
+        CachedTree.set_lookup_cache(64);
+        for (int i=0; i < 100; ++i)
+                CachedTree.find(i % 4);
+        CachedTree.erase(3);
+        CachedTree.balance();
+        CachedTree.insert(3, 33);
+        if (CachedTree.lookup_cache_stats().hits == 96 && CachedTree[3] == 33 && CachedTree.find(3)->second == 33 &&
+            CachedTree.lookup_cache_stats().hit_rate() > 0.9) std::cout << "lookup cache correct" << std::endl;
+        BST<int, int> MovedCacheTree;
+        MovedCacheTree = std::move(CachedTree);
+        for (int i=0; i < 10; ++i)
+                MovedCacheTree.find(1);
+        if (MovedCacheTree.lookup_cache_stats().hits == 9) std::cout << "lookup cache after move assignment correct" << std::endl;
+
+        //testing Bloom filter: set_bloom_filter(double false_positive_rate, std::size_t expected_keys), contains(const key k), may_contain(const key k)
+        BST<int, int> FilteredTree = ParallelTree;
+        FilteredTree.set_bloom_filter(0.01);
+        for (int i=1000; i < 5000; ++i)
+                FilteredTree.insert(i, i);
+        FilteredTree.erase(10);
+        FilteredTree.balance();
+        int false_positives = 0;
+        for (int i=5000; i < 105000; ++i)
+                false_positives += FilteredTree.may_contain(i);
+        bool no_false_negatives = true;
+        for (int i=11; i < 5000; ++i)
+                no_false_negatives = no_false_negatives && FilteredTree.contains(i);
+        if (no_false_negatives && !FilteredTree.contains(10) && !FilteredTree.contains(-1) && false_positives < 2000)
+                std::cout << "Bloom filter correct" << std::endl;
+        //overwriting values adds no keys, so the filter must not grow
+        std::size_t filter_bytes = FilteredTree.bloom_filter_bytes();
+        for (int round=0; round < 10; ++round)
+                for (int i=1000; i < 5000; ++i)
+                        FilteredTree.insert(i, -i);
+        if (FilteredTree.bloom_filter_bytes() == filter_bytes && FilteredTree.contains(4999) && FilteredTree[4999] == -4999)
+                std::cout << "Bloom filter after overwrites correct" << std::endl;
+
+        //keys without std::hash: the lookup cache and the Bloom filter stay off, the rest only needs the comparisons
+        BST<OrderedOnly, int> UnhashedTree;
+        for (int i=0; i < 100; ++i)
+                UnhashedTree.insert(OrderedOnly{(i*37)%100}, i);
+        UnhashedTree.erase(OrderedOnly{5});
+        BST<OrderedOnly, int> UnhashedCopy = UnhashedTree;
+        UnhashedCopy.set_lookup_cache(16);
+        UnhashedCopy.set_bloom_filter(0.01);
+        UnhashedCopy.balance();
+        if (UnhashedCopy.size() == 99 && UnhashedCopy.find(OrderedOnly{6})->second == 38 && !UnhashedCopy.contains(OrderedOnly{5}) &&
+            UnhashedCopy.bloom_filter_bytes() == 0 && UnhashedCopy.lookup_cache_stats().misses == 0) std::cout << "keys without std::hash correct" << std::endl;
+
+        //testing hash indexed BST: insert, erase, find, operator[] and ordered iteration
+        HashIndexedBST<int, int> IndexedTree;
+        for (int i=0; i < 1000; ++i)
+                IndexedTree.insert((i*389)%1000, i);
+        for (int i=0; i < 1000; i+=3)
+                IndexedTree.erase(i);
+        IndexedTree.balance();
+        IndexedTree[2000] = 7;
+        HashIndexedBST<int, int> IndexedCopy = IndexedTree;
+        if (IndexedCopy.size() == 667 && IndexedCopy.find(3) == IndexedCopy.cend() && IndexedCopy.find(389)->second == 1 &&
+            IndexedCopy[2000] == 7 && std::is_sorted(IndexedCopy.begin(), IndexedCopy.end(), [](const std::pair<const int, int>& lhs, const std::pair<const int, int>& rhs) {
+                    return lhs.first < rhs.first;
+            }) && IndexedCopy.ordered().rank(500) == 333) std::cout << "hash indexed BST correct" << std::endl;
+
+        //testing radix tree: insert, erase, find, operator[] and ordered iteration over string keys
+        RadixTree<int> PathTree;
+        const char* paths[] = {"/usr/lib", "/usr/local/lib", "/usr/local/bin", "/usr", "/var/log", "/usr/local", "/", "/usr/lib64"};
+        for (int i=0; i < 8; ++i)
+                PathTree.insert(paths[i], i);
+        PathTree.erase("/usr/local");
+        PathTree.erase("/var");
+        PathTree["/usr/lib"] += 10;
+        std::string sorted_paths;
+        for (const auto& data_pair : PathTree)
+                sorted_paths += data_pair.first + " ";
+        if (PathTree.size() == 7 && sorted_paths == "/ /usr /usr/lib /usr/lib64 /usr/local/bin /usr/local/lib /var/log " && PathTree.find("/usr/lib")->second == 10 &&
+            PathTree.find("/usr/loc") == PathTree.end() && PathTree.contains("/usr/lib64") && !PathTree.contains("/usr/local")) std::cout << "radix tree correct" << std::endl;
+
+        //testing allocator support: PmrBST, BST(const Allocator& alloc), memory_usage()
+        static char arena_buffer[1 << 18];
+        std::pmr::monotonic_buffer_resource arena(arena_buffer, sizeof(arena_buffer), std::pmr::null_memory_resource());
+        PmrBST<int, int> ArenaTree{std::pmr::polymorphic_allocator<std::pair<const int, int> >(&arena)};
+        for (int i=0; i < 1000; ++i)
+                ArenaTree.insert((i*389)%1000, i);
+        ArenaTree.balance();
+        PmrBST<int, int> ArenaCopy(ArenaTree, ArenaTree.get_allocator());
+        if (ArenaCopy.get_allocator().resource() == &arena && ArenaCopy.memory_usage().nodes == 1000 && ArenaCopy.memory_usage().node_bytes >= 1000*sizeof(std::pair<const int, int>) &&
+            ArenaCopy[389] == 1) std::cout << "allocator support correct" << std::endl;
+        static char budget_buffer[4096];
+        std::pmr::monotonic_buffer_resource budget(budget_buffer, sizeof(budget_buffer), std::pmr::null_memory_resource());
+        PmrBST<int, int> BudgetTree{std::pmr::polymorphic_allocator<std::pair<const int, int> >(&budget)};
+        int inserted = 0;
+        try {
+                for (; inserted < 1000; ++inserted)
+                        BudgetTree.insert(inserted, inserted);
+        }
+        catch (const std::bad_alloc&) {
+                if (inserted > 0 && inserted < 1000 && BudgetTree.size() == std::size_t(inserted)) std::cout << "memory budget correct" << std::endl;
+        }
+
+        //testing partitioning: split(const key k), join(BST&& left, BST&& right), merge(BST& other)
+        BST<int, int> ShardTree = ParallelTree;
+        std::pair<BST<int, int>, BST<int, int> > Shards = ShardTree.split(600);
+        bool split_correct = ShardTree.size() == 0 && Shards.first.size() == 600 && Shards.second.size() == 400 &&
+                             Shards.first.rank(600) == 600 && Shards.second.cbegin()->first == 600 && Shards.second.select(399)->first == 999;
+        BST<int, int> JoinedTree = BST<int, int>::join(std::move(Shards.first), std::move(Shards.second));
+        BST<int, int> OverlapTree;
+        for (int i=990; i < 1010; ++i)
+                OverlapTree.insert(i, -i);
+        JoinedTree.merge(OverlapTree);
+        if (split_correct && JoinedTree.size() == 1010 && OverlapTree.size() == 0 && JoinedTree[995] == -995 && JoinedTree[500] == 500 &&
+            JoinedTree.rank(1000) == 1000 && std::distance(JoinedTree.cbegin(), JoinedTree.cend()) == 1010) std::cout << "split, join and merge correct" << std::endl;
+        //merge moves the values of other, also over the values of duplicate keys
+        BST<int, std::unique_ptr<int> > OwningLeft, OwningRight;
+        OwningLeft.emplace_hint(OwningLeft.end(), 1, std::make_unique<int>(1));
+        OwningRight.emplace_hint(OwningRight.end(), 1, std::make_unique<int>(-1));
+        OwningRight.emplace_hint(OwningRight.end(), 2, std::make_unique<int>(2));
+        OwningLeft.merge(OwningRight);
+        if (OwningLeft.size() == 2 && OwningRight.size() == 0 && *OwningLeft.find(1)->second == -1 && *OwningLeft.find(2)->second == 2)
+                std::cout << "merge with move-only values correct" << std::endl;
+
+        //testing sharded BST: insert_bulk, insert, erase, find and for_each across shards, re-splitting when skewed
+        ShardedBST<int, int> Sharded(4);
+        std::vector<std::pair<int, int> > bulk_pairs;
+        for (int i=0; i < 20000; ++i)
+                bulk_pairs.emplace_back((i*7919)%20000, i);
+        //re-splitting moves the shard trees around, which must not print the messages of BST
+        std::ostringstream sharded_output;
+        std::streambuf* console = std::cout.rdbuf(sharded_output.rdbuf());
+        Sharded.insert_bulk(bulk_pairs.begin(), bulk_pairs.end(), 2);
+        std::vector<int> bulk_split_points = Sharded.current_split_points();
+        for (int i=20000; i < 40000; ++i)
+                Sharded.insert(i, i);
+        Sharded.erase(7);
+        std::cout.rdbuf(console);
+        std::vector<std::size_t> shard_sizes = Sharded.shard_sizes();
+        int previous_key = -1;
+        bool sharded_ordered = true;
+        Sharded.for_each([&previous_key, &sharded_ordered](const std::pair<const int, int>& data_pair) {
+                sharded_ordered = sharded_ordered && previous_key < data_pair.first;
+                previous_key = data_pair.first;
+        });
+        if (sharded_ordered && sharded_output.str().empty() && Sharded.size() == 39999 && *Sharded.find(7919) == 1 && !Sharded.contains(7) && Sharded.current_split_points() != bulk_split_points &&
+            *std::max_element(shard_sizes.begin(), shard_sizes.end()) < 20000) std::cout << "sharded BST correct" << std::endl;
+
+        //testing flat combining: insert and operator[] from several threads, applied in sorted batches
+        CombiningBST<int, int> Combining;
+        std::vector<std::thread> writers;
+        for (int t=0; t < 4; ++t)
+                writers.emplace_back([&Combining, t]() {
+                        for (int i=t; i < 4000; i += 4)
+                                Combining.insert(i, 2*i);
+                        Combining[5000 + t];
+                });
+        for (auto& writer : writers)
+                writer.join();
+        int combined_sum = 0;
+        Combining.for_each([&combined_sum](const std::pair<const int, int>& data_pair) {
+                combined_sum += data_pair.second;
+        });
+        if (Combining.size() == 4004 && Combining[3999] == 7998 && *Combining.find(5002) == 0 && combined_sum == 3999*4000 &&
+            Combining.combining_stats().requests == 4005) std::cout << "flat combining correct" << std::endl;
+
+        //testing background rebalancing: rebalance_async() while another thread keeps writing and reading
+        ConcurrentBST<int, int> Concurrent(64);
+        for (int i=0; i < 2000; ++i)
+                Concurrent.insert(i, i);
+        bool rebalance_started = Concurrent.rebalance_async();
+        std::thread concurrent_writer([&Concurrent]() {
+                for (int i=0; i < 2000; i += 2)
+                        Concurrent.erase(i);
+                for (int i=2000; i < 3000; ++i)
+                        Concurrent.insert(i, -i);
+        });
+        bool concurrent_reads = true;
+        for (int i=1; i < 2000; i += 2)
+                concurrent_reads = concurrent_reads && Concurrent.find(i) == i;
+        concurrent_writer.join();
+        Concurrent.wait_rebalance();
+        int concurrent_sum = 0;
+        Concurrent.for_each([&concurrent_sum](const std::pair<const int, int>& data_pair) {
+                concurrent_sum += data_pair.second;
+        });
+        if (rebalance_started && concurrent_reads && !Concurrent.rebalancing() && Concurrent.size() == 2000 && !Concurrent.contains(1000) &&
+            concurrent_sum == 1000*1000 - 2499500) std::cout << "background rebalancing correct" << std::endl;
+
+        //testing hints and fingers: insert(hint, k, v), emplace_hint(hint, args...), find_from(finger, k)
+        BST<int, int> TimeTree = ParallelTree;
+        BST<int, int>::Iterator last_inserted = TimeTree.find(999);
+        for (int i=1000; i < 1100; ++i)
+                last_inserted = TimeTree.insert(last_inserted, i, i);
+        BST<int, int>::Iterator emplaced = TimeTree.emplace_hint(TimeTree.find(500), 1500, -1);
+        TimeTree.insert(TimeTree.find(10), 500, -500);
+        BST<int, int>::ConstIterator finger = TimeTree.cbegin();
+        bool fingers_correct = true;
+        for (int i=0; i < 1100; i += 7) {
+                finger = TimeTree.find_from(finger, i);
+                fingers_correct = fingers_correct && finger != TimeTree.cend() && finger->first == i;
+        }
+        if (fingers_correct && TimeTree.size() == 1101 && emplaced->second == -1 && TimeTree[500] == -500 && TimeTree.rank(1099) == 1099 &&
+            TimeTree.find_from(finger, 1200) == TimeTree.cend() && TimeTree.find_from(TimeTree.cend(), 1500)->second == -1) std::cout << "hinted insert and finger search correct" << std::endl;
+        //emplace_hint moves the value into the node, so move-only values work
+        BST<int, std::unique_ptr<int> > OwningTree;
+        BST<int, std::unique_ptr<int> >::Iterator owned = OwningTree.emplace_hint(OwningTree.end(), 1, std::make_unique<int>(7));
+        OwningTree.emplace_hint(owned, 2, std::make_unique<int>(8));
+        OwningTree.emplace_hint(OwningTree.end(), 2, std::make_unique<int>(9));
+        if (OwningTree.size() == 2 && *owned->second == 7 && *OwningTree.find(2)->second == 9) std::cout << "emplace_hint with move-only values correct" << std::endl;
+
+        //testing sorted batch lookup: find_sorted(first, last, out)
+        std::vector<int> sorted_queries{-5, 3, 3, 250, 999, 1000, 1500};
+        std::vector<BST<int, int>::ConstIterator> sorted_results;
+        ParallelTree.find_sorted(sorted_queries.begin(), sorted_queries.end(), std::back_inserter(sorted_results));
+        if (sorted_results.size() == 7 && sorted_results[0] == ParallelTree.cend() && sorted_results[1]->first == 3 && sorted_results[2] == sorted_results[1] &&
+            sorted_results[3]->first == 250 && sorted_results[4]->first == 999 && sorted_results[5] == ParallelTree.cend() &&
+            sorted_results[6] == ParallelTree.cend()) std::cout << "sorted batch lookup correct" << std::endl;
+
+        //testing node handles: extract(k), extract(iterator), insert(node handle) into another tree
+        BST<int, int> SourceTree = ParallelTree;
+        BST<int, int> TargetTree;
+        for (int i=0; i < 1000; i += 2)
+                TargetTree.insert(SourceTree.extract(i));
+        BST<int, int>::NodeHandle renamed = SourceTree.extract(SourceTree.find(1));
+        renamed.mutable_key() = 2001;
+        renamed.mapped() = -1;
+        BST<int, int>::InsertReturn moved = TargetTree.insert(std::move(renamed));
+        BST<int, int>::NodeHandle duplicate = SourceTree.extract(3);
+        duplicate.mutable_key() = 4;
+        BST<int, int>::InsertReturn rejected = TargetTree.insert(std::move(duplicate));
+        if (SourceTree.size() == 498 && TargetTree.size() == 501 && moved.inserted && moved.position->second == -1 && TargetTree.rank(2001) == 500 &&
+            !rejected.inserted && rejected.position->second == 4 && !rejected.node.empty() && SourceTree.extract(0).empty() && !SourceTree.contains(3)) std::cout << "node handles correct" << std::endl;
+        rejected.node.mutable_key() = 2003;
+        BST<int, int>::InsertReturn renamed_again = TargetTree.insert(std::move(rejected.node));
+        if (renamed_again.inserted && renamed_again.position->first == 2003 && renamed_again.position->second == 3 && TargetTree.rank(2003) == 501)
+                std::cout << "renamed node handle correct" << std::endl;
+
+        //testing node layout: compact(layout), balance(layout), nodes of a block outliving their tree
+        BST<int, int> CompactTree = ParallelTree;
+        CompactTree.compact();
+        bool compacted_equal = std::equal(CompactTree.cbegin(), CompactTree.cend(), ParallelTree.cbegin(), ParallelTree.cend());
+        CompactTree.insert(1000, 1000);
+        CompactTree.erase(5);
+        CompactTree.compact(NodeLayout::breadth_first);
+        auto compact_parts = CompactTree.split(500);
+        BST<int, int>::NodeHandle outliving;
+        {
+                BST<int, int> ScratchTree = ParallelTree;
+                ScratchTree.balance(NodeLayout::van_emde_boas);
+                ScratchTree = std::move(ScratchTree);
+                outliving = ScratchTree.extract(5);
+        }
+        compact_parts.first.insert(std::move(outliving));
+        //a rejected join of compacted trees must leave them owning their blocks
+        BST<int, int> CompactLeft = compact_parts.first;
+        BST<int, int> CompactRight = compact_parts.second;
+        CompactLeft.compact();
+        CompactRight.compact();
+        CompactRight.insert(0, 0);
+        bool join_rejected = false;
+        try {
+                BST<int, int>::join(std::move(CompactLeft), std::move(CompactRight));
+        }
+        catch (const std::runtime_error&) {
+                join_rejected = true;
+        }
+        join_rejected = join_rejected && CompactLeft.size() == 500 && CompactRight.size() == 502 && CompactLeft[499] == 499 && CompactRight[1000] == 1000;
+        if (compacted_equal && join_rejected && CompactTree.size() == 0 && compact_parts.first.size() == 500 && compact_parts.second.size() == 501 &&
+            compact_parts.first[5] == 5 && compact_parts.first.rank(6) == 6 && compact_parts.second.rank(1000) == 500) std::cout << "node layout correct" << std::endl;
+
+        //testing huge page storage: HugePageResource behind a PmrBST, nodes reused after erase, compact() into its own mapping
+        {
+                HugePageResource huge_pages;
+                PmrBST<int, int> HugeTree{std::pmr::polymorphic_allocator<std::pair<const int, int> >(&huge_pages)};
+                for (int i=0; i < 10000; ++i)
+                        HugeTree.insert((i*7919)%10000, i);
+                std::size_t pages_mapped = huge_pages.mapped_bytes();
+                for (int i=0; i < 10000; i += 2)
+                        HugeTree.erase(i);
+                for (int i=10000; i < 15000; ++i)
+                        HugeTree.insert(i, i);
+                bool nodes_reused = huge_pages.mapped_bytes() == pages_mapped;
+                HugeTree.compact();
+                if (nodes_reused && pages_mapped % (1 << 21) == 0 && huge_pages.mapped_bytes() > pages_mapped && HugeTree.size() == 10000 &&
+                    HugeTree.rank(10000) == 5000 && HugeTree[7919] == 1 && huge_pages.reserved_bytes() <= huge_pages.mapped_bytes()) std::cout << "huge page storage correct" << std::endl;
+        }
+
+        //testing compile-time map: make_static_map(entries), find(k), operator[], ConstIterator in key order
+        constexpr auto StatusNames = make_static_map<int, std::string_view>({{404, "not found"}, {200, "ok"}, {500, "server error"}, {301, "moved"},
+                                                                             {204, "no content"}, {418, "teapot"}});
+        static_assert(StatusNames.find(418)->second == "teapot" && StatusNames.find(999) == StatusNames.cend() && StatusNames[200] == "ok",
+                      "StaticMap lookups are resolved at compile time");
+        int previous_status = 0;
+        bool static_ordered = true;
+        for (const auto& entry : StatusNames) {
+                static_ordered = static_ordered && previous_status < entry.first;
+                previous_status = entry.first;
+        }
+        if (static_ordered && previous_status == 500 && std::distance(StatusNames.begin(), StatusNames.end()) == 6 && StatusNames.contains(301) &&
+            !StatusNames.contains(302)) std::cout << "static map correct" << std::endl;
+
+        //testing aggregation policy: reduce(const key a, const key b)
+        AggregateBST<int, int, SumAggregation<int> > SumTree;
+        AggregateBST<int, int, MaxAggregation<int> > MaxTree;
+        for (int i=0; i < 100; ++i) {
+                SumTree.insert(i, i);
+                MaxTree.insert((i*37)%100, i);
+        }
+        if (SumTree.reduce(10, 20) == 145) std::cout << "reduce sum correct" << std::endl;
+        SumTree.insert(15, 1015);
+        SumTree.erase(11);
+        if (SumTree.reduce(10, 20) == 1134) std::cout << "reduce after insert and erase correct" << std::endl;
+        if (MaxTree.reduce(0, 50) == 98) std::cout << "reduce max correct" << std::endl;
+        if (SumTree.reduce(200, 300) == 0) std::cout << "reduce of empty range correct" << std::endl;
+
+        //testing value updates of an aggregating tree: insert replaces values and refreshes the aggregates, while operator[],
+        //Iterator and for_each only give read access there
+        AggregateBST<int, int, SumAggregation<int> > UpdatedTree;
+        for (int i=0; i < 10; ++i)
+                UpdatedTree.insert(i, i);
+        for (int i=0; i < 10; ++i)
+                UpdatedTree.insert(i, i+1);
+        bool updated_sums = UpdatedTree.reduce(0, 10) == 55 && UpdatedTree.reduce(1, 9) == 44;
+        for (auto hint = UpdatedTree.begin(); hint != UpdatedTree.end(); ++hint)
+                UpdatedTree.insert(hint, hint->first, 2);
+        int read_sum = 0;
+        UpdatedTree.for_each([&read_sum](const std::pair<const int, int>& data_pair) {
+                read_sum += data_pair.second;
+        });
+        static_assert(std::is_same<decltype(UpdatedTree[0]), const int&>::value && std::is_same<decltype(*UpdatedTree.begin()), const std::pair<const int, int>&>::value,
+                      "values of an aggregating tree are read-only outside insert");
+        if (updated_sums && UpdatedTree.reduce(1, 9) == 16 && UpdatedTree.reduce(0, 10) == read_sum && UpdatedTree[3] == 2) std::cout << "reduce after value updates correct" << std::endl;
+
         //testing copy constructor
         BST<int, int> BinarySearchTree_copy_cotr = BinarySearchTree;
         std::cout << BinarySearchTree_copy_cotr;